@@ -0,0 +1,30 @@
+#include "ParseArena.hpp"
+
+#include <cstdlib>
+#include <new>
+
+// Global operator new / delete routed through ParseArena. Linking this file
+// is what turns arenas on; see ParseArena.hpp.
+
+void *operator new(std::size_t size) throw(std::bad_alloc) {
+  void *ptr = ParseArena::allocateHooked(size);
+  if (ptr)
+    return ptr;
+  ptr = std::malloc(size ? size : 1);
+  if (!ptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void *ptr) throw() {
+  if (!ParseArena::releaseHooked(ptr))
+    std::free(ptr);
+}
+
+namespace {
+struct HookInstaller {
+  HookInstaller(void) { ParseArena::installHooks(); }
+};
+
+HookInstaller g_installer;
+} // namespace
@@ -0,0 +1,137 @@
+#include "BatchValidator.hpp"
+
+#include <algorithm>
+#include <dirent.h>
+#include <stdexcept>
+#include <sys/time.h>
+
+#include "ConfigurationFile.hpp"
+#include "ServerConfigParser.hpp"
+#include "WorkerPool.hpp"
+
+namespace {
+double nowMs(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (static_cast<double>(tv.tv_sec) * 1000.0 +
+          static_cast<double>(tv.tv_usec) / 1000.0);
+}
+
+bool hasConfExtension(const std::string &name) {
+  const std::string extension = ".conf";
+  return (name.size() > extension.size() &&
+          name.compare(name.size() - extension.size(), extension.size(),
+                       extension) == 0);
+}
+
+struct BatchJob {
+  std::vector<BatchValidator::Result> *results;
+  size_t probe_threads;
+  FileSystem *filesystem;
+};
+} // namespace
+
+BatchValidator::BatchValidator(void)
+    : _paths(), _results(), _threads(0), _probe_threads(1), _filesystem(NULL),
+      _elapsed_ms(0) {}
+
+BatchValidator::BatchValidator(const BatchValidator &other)
+    : _paths(other._paths), _results(other._results),
+      _threads(other._threads), _probe_threads(other._probe_threads),
+      _filesystem(other._filesystem), _elapsed_ms(other._elapsed_ms) {}
+
+BatchValidator &BatchValidator::operator=(const BatchValidator &other) {
+  if (this != &other) {
+    _paths = other._paths;
+    _results = other._results;
+    _threads = other._threads;
+    _probe_threads = other._probe_threads;
+    _filesystem = other._filesystem;
+    _elapsed_ms = other._elapsed_ms;
+  }
+  return (*this);
+}
+
+BatchValidator::~BatchValidator() {}
+
+void BatchValidator::addPath(const std::string &path) {
+  if (ConfigurationFile::getTypePath(path) != 2) {
+    _paths.push_back(path);
+    return;
+  }
+  DIR *dir = opendir(path.c_str());
+  if (!dir)
+    throw std::runtime_error("Cannot read directory: " + path);
+  std::vector<std::string> names;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] != '.' && hasConfExtension(entry->d_name))
+      names.push_back(entry->d_name);
+  }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+  for (size_t i = 0; i < names.size(); ++i)
+    _paths.push_back(joinPaths(path, names[i]));
+}
+
+const std::vector<std::string> &BatchValidator::getPaths(void) const {
+  return _paths;
+}
+
+void BatchValidator::setThreads(size_t threads) { _threads = threads; }
+
+void BatchValidator::setProbeThreads(size_t threads) {
+  _probe_threads = threads;
+}
+
+void BatchValidator::setFileSystem(FileSystem *filesystem) {
+  _filesystem = filesystem;
+}
+
+void BatchValidator::_checkTask(size_t index, void *context) {
+  BatchJob &job = *static_cast<BatchJob *>(context);
+  Result &result = (*job.results)[index];
+  const double start = nowMs();
+  try {
+    ServerConfigParser parser;
+    parser.setProbeThreads(job.probe_threads);
+    parser.setFileSystem(job.filesystem);
+    parser.createCluster(result.path);
+    result.servers = parser.getServers().size();
+    result.valid = true;
+  } catch (const std::exception &e) {
+    result.error = e.what();
+  }
+  result.elapsed_ms = nowMs() - start;
+}
+
+size_t BatchValidator::run(void) {
+  Result blank;
+  blank.valid = false;
+  blank.servers = 0;
+  blank.elapsed_ms = 0;
+  _results.assign(_paths.size(), blank);
+  for (size_t i = 0; i < _paths.size(); ++i)
+    _results[i].path = _paths[i];
+
+  BatchJob job;
+  job.results = &_results;
+  job.probe_threads = _probe_threads;
+  // Workers start with no backend of their own; hand them the caller's.
+  job.filesystem = _filesystem ? _filesystem : FileSystem::active();
+  const double start = nowMs();
+  WorkerPool(_threads).run(_paths.size(), &_checkTask, &job);
+  _elapsed_ms = nowMs() - start;
+
+  size_t invalid = 0;
+  for (size_t i = 0; i < _results.size(); ++i)
+    invalid += !_results[i].valid;
+  return invalid;
+}
+
+const std::vector<BatchValidator::Result> &
+BatchValidator::getResults(void) const {
+  return _results;
+}
+
+double BatchValidator::getElapsedMs(void) const { return _elapsed_ms; }
@@ -0,0 +1,61 @@
+#ifndef BATCHVALIDATOR_HPP
+#define BATCHVALIDATOR_HPP
+
+#include <string>
+#include <vector>
+
+#include "FileSystem.hpp"
+
+// Validation-only checking of many configuration files: each file goes
+// through ServerConfigParser::createCluster on a worker thread with its own
+// parser, and nothing is bound or listened on. Meant for pipelines that
+// vet thousands of generated configs before a rollout.
+class BatchValidator {
+public:
+  struct Result {
+    std::string path;
+    bool valid;
+    size_t servers;    // when valid
+    std::string error; // when not
+    double elapsed_ms;
+  };
+
+private:
+  std::vector<std::string> _paths;
+  std::vector<Result> _results;
+  size_t _threads;
+  size_t _probe_threads;
+  FileSystem *_filesystem;
+  double _elapsed_ms;
+
+  static void _checkTask(size_t index, void *context);
+
+public:
+  BatchValidator(void);
+  BatchValidator(const BatchValidator &other);
+  BatchValidator &operator=(const BatchValidator &other);
+  ~BatchValidator();
+
+  // A file is queued as is; a directory queues its *.conf entries (not
+  // recursively) in name order. Throws when `path` cannot be read.
+  void addPath(const std::string &path);
+  const std::vector<std::string> &getPaths(void) const;
+
+  // Files checked at once (0: one per online CPU, the default).
+  void setThreads(size_t threads);
+  // Probe threads of each file's parser; 1 by default, since the files
+  // already keep the workers busy.
+  void setProbeThreads(size_t threads);
+  // Backend the files and everything they reference are looked up in;
+  // NULL (the default) uses the one active on the calling thread.
+  void setFileSystem(FileSystem *filesystem);
+
+  // Checks every queued file. Results come back in queue order; returns
+  // the number of invalid files.
+  size_t run(void);
+  const std::vector<Result> &getResults(void) const;
+  // Wall-clock time of the last run.
+  double getElapsedMs(void) const;
+};
+
+#endif
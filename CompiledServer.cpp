@@ -0,0 +1,166 @@
+#include "CompiledServer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+const size_t CompiledServer::npos;
+const uint8_t CompiledServer::kAutoindex;
+const uint8_t CompiledServer::kRedirect;
+const uint8_t CompiledServer::kAlias;
+const uint8_t CompiledServer::kCgi;
+
+namespace {
+struct LongerPath {
+  const std::vector<LocationBlock> *locations;
+
+  bool operator()(uint32_t left, uint32_t right) const {
+    return ((*locations)[left].getPath().size() >
+            (*locations)[right].getPath().size());
+  }
+};
+} // namespace
+
+CompiledServer::CompiledServer(void)
+    : _strings(), _paths(), _flags(), _methods(), _max_body_sizes(), _roots(),
+      _indexes(), _redirects(), _match_paths(), _match_locations() {}
+
+CompiledServer::CompiledServer(const WebserverConfig &server)
+    : _strings(), _paths(), _flags(), _methods(), _max_body_sizes(), _roots(),
+      _indexes(), _redirects(), _match_paths(), _match_locations() {
+  compile(server);
+}
+
+CompiledServer::CompiledServer(const CompiledServer &other)
+    : _strings(other._strings), _paths(other._paths), _flags(other._flags),
+      _methods(other._methods), _max_body_sizes(other._max_body_sizes),
+      _roots(other._roots), _indexes(other._indexes),
+      _redirects(other._redirects), _match_paths(other._match_paths),
+      _match_locations(other._match_locations) {}
+
+CompiledServer &CompiledServer::operator=(const CompiledServer &other) {
+  if (this != &other) {
+    _strings = other._strings;
+    _paths = other._paths;
+    _flags = other._flags;
+    _methods = other._methods;
+    _max_body_sizes = other._max_body_sizes;
+    _roots = other._roots;
+    _indexes = other._indexes;
+    _redirects = other._redirects;
+    _match_paths = other._match_paths;
+    _match_locations = other._match_locations;
+  }
+  return (*this);
+}
+
+CompiledServer::~CompiledServer() {}
+
+CompiledServer::Text
+CompiledServer::_add(const std::string &value,
+                     std::map<std::string, Text> &seen) {
+  std::map<std::string, Text>::iterator it = seen.find(value);
+  if (it != seen.end())
+    return it->second;
+  if (_strings.size() + value.size() > 0xFFFFFFFFUL)
+    throw std::runtime_error("Compiled server is too large");
+  Text text;
+  text.offset = static_cast<uint32_t>(_strings.size());
+  text.length = static_cast<uint32_t>(value.size());
+  _strings.append(value);
+  seen[value] = text;
+  return text;
+}
+
+StringSpan CompiledServer::_text(const Text &text) const {
+  return StringSpan(_strings.data() + text.offset, text.length);
+}
+
+void CompiledServer::compile(const WebserverConfig &server) {
+  const std::vector<LocationBlock> &locations = server.getLocationBlocks();
+  const size_t count = locations.size();
+  std::map<std::string, Text> seen;
+  _strings.clear();
+  _paths.resize(count);
+  _flags.assign(count, 0);
+  _methods.assign(count, 0);
+  _max_body_sizes.resize(count);
+  _roots.resize(count);
+  _indexes.resize(count);
+  _redirects.resize(count);
+  // Paths first, so the blob the matcher reads is one run.
+  _match_locations.resize(count);
+  for (size_t i = 0; i < count; ++i)
+    _match_locations[i] = static_cast<uint32_t>(i);
+  LongerPath longer;
+  longer.locations = &locations;
+  std::stable_sort(_match_locations.begin(), _match_locations.end(), longer);
+  _match_paths.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    _match_paths[i] = _add(locations[_match_locations[i]].getPath(), seen);
+    _paths[_match_locations[i]] = _match_paths[i];
+  }
+  for (size_t i = 0; i < count; ++i) {
+    const LocationBlock &location = locations[i];
+    if (location.getAutoindex())
+      _flags[i] |= kAutoindex;
+    if (!location.getReturn().empty())
+      _flags[i] |= kRedirect;
+    if (!location.getAlias().empty())
+      _flags[i] |= kAlias;
+    if (!location.getExtensionToCgiMap().empty())
+      _flags[i] |= kCgi;
+    _methods[i] = location.getMethods();
+    _max_body_sizes[i] = location.getMaxBodySize();
+    _roots[i] = _add(location.getRoot(), seen);
+    _indexes[i] = _add(location.getIndex(), seen);
+    _redirects[i] = _add(location.getReturn(), seen);
+  }
+}
+
+size_t CompiledServer::size(void) const { return _paths.size(); }
+
+size_t CompiledServer::match(const StringSpan &uri) const {
+  const char *strings = _strings.data();
+  for (size_t i = 0; i < _match_paths.size(); ++i) {
+    const uint32_t length = _match_paths[i].length;
+    if (length > uri.length)
+      continue;
+    const char *path = strings + _match_paths[i].offset;
+    if (std::memcmp(path, uri.data, length))
+      continue;
+    if (length && path[length - 1] != '/' && length < uri.length &&
+        uri.data[length] != '/')
+      continue;
+    return _match_locations[i];
+  }
+  return npos;
+}
+
+StringSpan CompiledServer::getPath(size_t location) const {
+  return _text(_paths[location]);
+}
+
+uint8_t CompiledServer::getFlags(size_t location) const {
+  return _flags[location];
+}
+
+uint8_t CompiledServer::getMethods(size_t location) const {
+  return _methods[location];
+}
+
+uint64_t CompiledServer::getMaxBodySize(size_t location) const {
+  return _max_body_sizes[location];
+}
+
+StringSpan CompiledServer::getRoot(size_t location) const {
+  return _text(_roots[location]);
+}
+
+StringSpan CompiledServer::getIndex(size_t location) const {
+  return _text(_indexes[location]);
+}
+
+StringSpan CompiledServer::getRedirect(size_t location) const {
+  return _text(_redirects[location]);
+}
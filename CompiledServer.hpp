@@ -0,0 +1,75 @@
+#ifndef COMPILEDSERVER_HPP
+#define COMPILEDSERVER_HPP
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "ParserUtils.hpp"
+#include "WebserverConfig.hpp"
+
+// Request-time view of one parsed server. WebserverConfig and LocationBlock
+// are built for parsing: every location is a cluster of strings, vectors
+// and a map on the heap. Here the fields a request reads are laid out one
+// array per field, indexed by location, with every string in one blob, so
+// matching a URI scans two small arrays and reading the result touches a
+// handful of cache lines. Immutable once compiled; copies are independent.
+class CompiledServer {
+private:
+  struct Text {
+    uint32_t offset;
+    uint32_t length;
+  };
+
+  std::string _strings;
+  std::vector<Text> _paths;
+  std::vector<uint8_t> _flags;
+  std::vector<uint8_t> _methods;
+  std::vector<uint64_t> _max_body_sizes;
+  std::vector<Text> _roots;
+  std::vector<Text> _indexes;
+  std::vector<Text> _redirects;
+  // The paths again, longest first, with their location: the first one
+  // that matches is the longest match.
+  std::vector<Text> _match_paths;
+  std::vector<uint32_t> _match_locations;
+
+  // Each distinct value is stored once.
+  Text _add(const std::string &value, std::map<std::string, Text> &seen);
+  StringSpan _text(const Text &text) const;
+
+public:
+  static const size_t npos = static_cast<size_t>(-1);
+
+  // Bits of getFlags().
+  static const uint8_t kAutoindex = 1;
+  static const uint8_t kRedirect = 2;
+  static const uint8_t kAlias = 4;
+  static const uint8_t kCgi = 8;
+
+  CompiledServer(void);
+  explicit CompiledServer(const WebserverConfig &server);
+  CompiledServer(const CompiledServer &other);
+  CompiledServer &operator=(const CompiledServer &other);
+  ~CompiledServer();
+
+  void compile(const WebserverConfig &server);
+  size_t size(void) const;
+
+  // The location with the longest path that prefixes `uri` on a segment
+  // boundary ("/img" takes "/img" and "/img/a.png", not "/images"), npos
+  // when none does.
+  size_t match(const StringSpan &uri) const;
+
+  StringSpan getPath(size_t location) const;
+  uint8_t getFlags(size_t location) const;
+  // LocationBlock::kMethod* bits.
+  uint8_t getMethods(size_t location) const;
+  uint64_t getMaxBodySize(size_t location) const;
+  StringSpan getRoot(size_t location) const;
+  StringSpan getIndex(size_t location) const;
+  StringSpan getRedirect(size_t location) const;
+};
+
+#endif
@@ -0,0 +1,151 @@
+#include "ConfigLexer.hpp"
+
+#include <stdexcept>
+
+ConfigLexer::ConfigLexer(void)
+    : _source(""), _tokens(), _kernel(SCAN_AUTO) {}
+
+ConfigLexer::ConfigLexer(const ConfigLexer &other)
+    : _source(other._source), _tokens(other._tokens),
+      _kernel(other._kernel) {}
+
+ConfigLexer &ConfigLexer::operator=(const ConfigLexer &other) {
+  if (this != &other) {
+    _source = other._source;
+    _tokens = other._tokens;
+    _kernel = other._kernel;
+  }
+  return (*this);
+}
+
+ConfigLexer::~ConfigLexer() {}
+
+void ConfigLexer::_pushToken(ConfigTokenType type, size_t offset,
+                             size_t length) {
+  ConfigToken token;
+  token.type = type;
+  token.offset = offset;
+  token.length = length;
+  token.match = std::string::npos;
+  _tokens.push_back(token);
+}
+
+void ConfigLexer::tokenize(const char *data, size_t size) {
+  if (size > ConfigScanner::kMaxInput)
+    throw std::runtime_error("Configuration file is too large");
+
+  ConfigScanner scanner(_kernel);
+  scanner.scan(data, size);
+  const std::vector<uint32_t> &index = scanner.getIndex();
+
+  std::vector<size_t> open_blocks;
+  size_t word_start = std::string::npos;
+  bool in_comment = false;
+
+  _source = data;
+  _tokens.clear();
+  // A word costs two index entries (start and end), a brace one.
+  _tokens.reserve(index.size() / 2 + 1);
+  for (size_t i = 0; i < index.size(); ++i) {
+    const size_t pos = index[i];
+    const char c = data[pos];
+    if (in_comment) {
+      in_comment = (c != '\n');
+      continue;
+    }
+    if (c == ';') {
+      if (word_start == std::string::npos)
+        word_start = pos;
+      _pushToken(TOKEN_WORD, word_start, pos + 1 - word_start);
+      word_start = std::string::npos;
+      continue;
+    }
+    const bool starts_word = (c != '{' && c != '}' && c != '#' && c != ' ' &&
+                              (c < '\t' || c > '\r'));
+    if (starts_word) {
+      word_start = pos;
+      continue;
+    }
+    if (word_start != std::string::npos) {
+      _pushToken(TOKEN_WORD, word_start, pos - word_start);
+      word_start = std::string::npos;
+    }
+    if (c == '#') {
+      in_comment = true;
+    } else if (c == '{') {
+      open_blocks.push_back(_tokens.size());
+      _pushToken(TOKEN_BLOCK_START, pos, 1);
+    } else if (c == '}') {
+      _pushToken(TOKEN_BLOCK_END, pos, 1);
+      if (!open_blocks.empty()) {
+        _tokens[open_blocks.back()].match = _tokens.size() - 1;
+        _tokens.back().match = open_blocks.back();
+        open_blocks.pop_back();
+      }
+    }
+  }
+  if (word_start != std::string::npos)
+    _pushToken(TOKEN_WORD, word_start, size - word_start);
+}
+
+void ConfigLexer::setScanKernel(ScanKernel kernel) { _kernel = kernel; }
+
+void ConfigLexer::rebase(const char *data) { _source = data; }
+
+void ConfigLexer::appendTokens(const ConfigLexer &other, size_t begin,
+                               size_t end, size_t shift) {
+  for (size_t i = begin; i < end; ++i) {
+    _tokens.push_back(other._tokens[i]);
+    _tokens.back().offset += shift;
+  }
+}
+
+void ConfigLexer::matchBraces(void) {
+  std::vector<size_t> open_blocks;
+  for (size_t i = 0; i < _tokens.size(); ++i) {
+    _tokens[i].match = std::string::npos;
+    if (_tokens[i].type == TOKEN_BLOCK_START) {
+      open_blocks.push_back(i);
+    } else if (_tokens[i].type == TOKEN_BLOCK_END && !open_blocks.empty()) {
+      _tokens[open_blocks.back()].match = i;
+      _tokens[i].match = open_blocks.back();
+      open_blocks.pop_back();
+    }
+  }
+}
+
+void ConfigLexer::clear(void) {
+  _source = "";
+  _tokens.clear();
+}
+
+void ConfigLexer::release(void) {
+  _source = "";
+  std::vector<ConfigToken>().swap(_tokens);
+}
+
+size_t ConfigLexer::size(void) const { return _tokens.size(); }
+
+bool ConfigLexer::empty(void) const { return _tokens.empty(); }
+
+ConfigTokenType ConfigLexer::type(size_t index) const {
+  return _tokens[index].type;
+}
+
+StringSpan ConfigLexer::text(size_t index) const {
+  return StringSpan(_source + _tokens[index].offset, _tokens[index].length);
+}
+
+size_t ConfigLexer::match(size_t index) const { return _tokens[index].match; }
+
+bool ConfigLexer::isWord(size_t index) const {
+  return (_tokens[index].type == TOKEN_WORD);
+}
+
+bool ConfigLexer::equals(size_t index, const char *word) const {
+  return (_tokens[index].type == TOKEN_WORD && text(index) == word);
+}
+
+bool ConfigLexer::isTerminated(size_t index) const {
+  return (text(index).back() == ';');
+}
@@ -0,0 +1,69 @@
+#ifndef CONFIGLEXER_HPP
+#define CONFIGLEXER_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "ConfigScanner.hpp"
+#include "ParserUtils.hpp"
+
+enum ConfigTokenType { TOKEN_WORD, TOKEN_BLOCK_START, TOKEN_BLOCK_END };
+
+// Tokens are offset/length spans into the lexed buffer; nothing is copied.
+// A word keeps its trailing ';' so directive setters can still enforce it.
+// Braces carry the index of their matching brace (npos when unbalanced).
+struct ConfigToken {
+  ConfigTokenType type;
+  size_t offset;
+  size_t length;
+  size_t match;
+};
+
+struct TokenRange {
+  size_t begin;
+  size_t end;
+};
+
+class ConfigLexer {
+private:
+  const char *_source;
+  std::vector<ConfigToken> _tokens;
+  ScanKernel _kernel;
+
+  void _pushToken(ConfigTokenType type, size_t offset, size_t length);
+
+public:
+  ConfigLexer(void);
+  ConfigLexer(const ConfigLexer &other);
+  ConfigLexer &operator=(const ConfigLexer &other);
+  ~ConfigLexer();
+
+  // Builds tokens from the ConfigScanner index: comments and whitespace are
+  // dropped, braces become their own tokens and ';' terminates the current
+  // word. The buffer is not copied and must outlive the lexer (see rebase()).
+  void tokenize(const char *data, size_t size);
+  void setScanKernel(ScanKernel kernel);
+  void rebase(const char *data);
+  // Splicing tokens lexed elsewhere (see IncludeExpander): appends tokens
+  // [begin, end) of `other` with offsets moved by `shift`, so they point
+  // into this lexer's buffer once it is rebased onto the combined text.
+  // Matches are stale until matchBraces() recomputes them.
+  void appendTokens(const ConfigLexer &other, size_t begin, size_t end,
+                    size_t shift);
+  void matchBraces(void);
+  void clear(void);
+  // Like clear(), but also hands the token storage back.
+  void release(void);
+
+  size_t size(void) const;
+  bool empty(void) const;
+  ConfigTokenType type(size_t index) const;
+  StringSpan text(size_t index) const;
+  size_t match(size_t index) const;
+  bool isWord(size_t index) const;
+  bool equals(size_t index, const char *word) const;
+  bool isTerminated(size_t index) const;
+};
+
+#endif
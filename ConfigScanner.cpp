@@ -0,0 +1,288 @@
+#include "ConfigScanner.hpp"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CONFIG_SCANNER_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+namespace {
+struct BlockMasks {
+  uint64_t special; // '{', '}', ';', '#', '\n'
+  uint64_t blank;   // ' ', '\t', '\n', '\v', '\f', '\r'
+};
+
+inline bool isSpecial(unsigned char c) {
+  return (c == '{' || c == '}' || c == ';' || c == '#' || c == '\n');
+}
+
+inline bool isBlank(unsigned char c) {
+  return (c == ' ' || (c >= '\t' && c <= '\r'));
+}
+
+void classifyScalar(const unsigned char *block, BlockMasks &masks) {
+  masks.special = 0;
+  masks.blank = 0;
+  for (unsigned int i = 0; i < 64; ++i) {
+    if (isSpecial(block[i]))
+      masks.special |= (static_cast<uint64_t>(1) << i);
+    if (isBlank(block[i]))
+      masks.blank |= (static_cast<uint64_t>(1) << i);
+  }
+}
+
+// Keeps one bit per structural position: every special byte, the first byte
+// of each word, and the blank that directly follows a word.
+inline uint64_t structuralBits(const BlockMasks &masks, uint64_t &prev_word) {
+  const uint64_t word = ~(masks.special | masks.blank);
+  const uint64_t after_word = (word << 1) | prev_word;
+  prev_word = word >> 63;
+  const uint64_t starts = word & ~after_word;
+  const uint64_t ends = masks.blank & ~masks.special & after_word;
+  return (masks.special | starts | ends);
+}
+
+inline void flattenBits(uint64_t bits, uint32_t base, uint32_t *out,
+                        size_t &count) {
+  while (bits) {
+    out[count++] = base + static_cast<uint32_t>(__builtin_ctzll(bits));
+    bits &= bits - 1;
+  }
+}
+
+inline void reserveBlock(std::vector<uint32_t> &index, size_t count) {
+  if (count + 64 > index.size())
+    index.resize(index.size() * 2 > count + 64 ? index.size() * 2
+                                               : count + 64);
+}
+
+// The last partial block is padded with blanks so every kernel can read a
+// full 64 bytes; positions past the input are dropped by the caller.
+inline void loadTail(const char *data, size_t size, size_t pos,
+                     unsigned char *tail) {
+  std::memset(tail, ' ', 64);
+  std::memcpy(tail, data + pos, size - pos);
+}
+
+size_t scanScalar(const char *data, size_t size,
+                  std::vector<uint32_t> &index) {
+  size_t count = 0;
+  uint64_t prev_word = 0;
+  BlockMasks masks;
+  unsigned char tail[64];
+  for (size_t pos = 0; pos < size; pos += 64) {
+    const unsigned char *block =
+        reinterpret_cast<const unsigned char *>(data + pos);
+    if (size - pos < 64) {
+      loadTail(data, size, pos, tail);
+      block = tail;
+    }
+    classifyScalar(block, masks);
+    reserveBlock(index, count);
+    flattenBits(structuralBits(masks, prev_word), static_cast<uint32_t>(pos),
+                &index[0], count);
+  }
+  return count;
+}
+
+#ifdef CONFIG_SCANNER_X86
+#ifdef __SSE2__
+inline uint64_t sse2Mask(__m128i chunk, __m128i *targets, size_t count) {
+  __m128i hit = _mm_cmpeq_epi8(chunk, targets[0]);
+  for (size_t i = 1; i < count; ++i)
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(chunk, targets[i]));
+  return static_cast<uint64_t>(
+      static_cast<uint32_t>(_mm_movemask_epi8(hit)) & 0xffffU);
+}
+
+inline uint64_t sse2BlankMask(__m128i chunk) {
+  // '\t'..'\r' is a contiguous range: (c - '\t') <= 4 as unsigned bytes.
+  const __m128i shifted = _mm_sub_epi8(chunk, _mm_set1_epi8('\t'));
+  const __m128i in_range =
+      _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+  const __m128i space = _mm_cmpeq_epi8(chunk, _mm_set1_epi8(' '));
+  return static_cast<uint64_t>(
+      static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(in_range, space))) &
+      0xffffU);
+}
+
+size_t scanSse2(const char *data, size_t size, std::vector<uint32_t> &index) {
+  __m128i targets[5];
+  targets[0] = _mm_set1_epi8('{');
+  targets[1] = _mm_set1_epi8('}');
+  targets[2] = _mm_set1_epi8(';');
+  targets[3] = _mm_set1_epi8('#');
+  targets[4] = _mm_set1_epi8('\n');
+
+  size_t count = 0;
+  uint64_t prev_word = 0;
+  BlockMasks masks;
+  unsigned char tail[64];
+  for (size_t pos = 0; pos < size; pos += 64) {
+    const unsigned char *block =
+        reinterpret_cast<const unsigned char *>(data + pos);
+    if (size - pos < 64) {
+      loadTail(data, size, pos, tail);
+      block = tail;
+    }
+    masks.special = 0;
+    masks.blank = 0;
+    for (unsigned int lane = 0; lane < 4; ++lane) {
+      const __m128i chunk = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(block + lane * 16));
+      masks.special |= sse2Mask(chunk, targets, 5) << (lane * 16);
+      masks.blank |= sse2BlankMask(chunk) << (lane * 16);
+    }
+    reserveBlock(index, count);
+    flattenBits(structuralBits(masks, prev_word), static_cast<uint32_t>(pos),
+                &index[0], count);
+  }
+  return count;
+}
+#endif
+
+__attribute__((target("avx2"))) size_t
+scanAvx2(const char *data, size_t size, std::vector<uint32_t> &index) {
+  const __m256i open_brace = _mm256_set1_epi8('{');
+  const __m256i close_brace = _mm256_set1_epi8('}');
+  const __m256i semicolon = _mm256_set1_epi8(';');
+  const __m256i hash = _mm256_set1_epi8('#');
+  const __m256i newline = _mm256_set1_epi8('\n');
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i four = _mm256_set1_epi8(4);
+
+  size_t count = 0;
+  uint64_t prev_word = 0;
+  BlockMasks masks;
+  unsigned char tail[64];
+  for (size_t pos = 0; pos < size; pos += 64) {
+    const unsigned char *block =
+        reinterpret_cast<const unsigned char *>(data + pos);
+    if (size - pos < 64) {
+      loadTail(data, size, pos, tail);
+      block = tail;
+    }
+    masks.special = 0;
+    masks.blank = 0;
+    for (unsigned int lane = 0; lane < 2; ++lane) {
+      const __m256i chunk = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(block + lane * 32));
+      __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, open_brace),
+                                        _mm256_cmpeq_epi8(chunk, close_brace));
+      special = _mm256_or_si256(special, _mm256_cmpeq_epi8(chunk, semicolon));
+      special = _mm256_or_si256(special, _mm256_cmpeq_epi8(chunk, hash));
+      special = _mm256_or_si256(special, _mm256_cmpeq_epi8(chunk, newline));
+      const __m256i shifted = _mm256_sub_epi8(chunk, tab);
+      const __m256i blank = _mm256_or_si256(
+          _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, four), shifted),
+          _mm256_cmpeq_epi8(chunk, space));
+      masks.special |= static_cast<uint64_t>(static_cast<uint32_t>(
+                           _mm256_movemask_epi8(special)))
+                       << (lane * 32);
+      masks.blank |= static_cast<uint64_t>(
+                         static_cast<uint32_t>(_mm256_movemask_epi8(blank)))
+                     << (lane * 32);
+    }
+    reserveBlock(index, count);
+    flattenBits(structuralBits(masks, prev_word), static_cast<uint32_t>(pos),
+                &index[0], count);
+  }
+  return count;
+}
+#endif
+} // namespace
+
+ConfigScanner::ConfigScanner(void) : _kernel(detectKernel()), _index() {}
+
+ConfigScanner::ConfigScanner(ScanKernel kernel)
+    : _kernel(kernel == SCAN_AUTO || !isSupported(kernel) ? detectKernel()
+                                                          : kernel),
+      _index() {}
+
+ConfigScanner::ConfigScanner(const ConfigScanner &other)
+    : _kernel(other._kernel), _index(other._index) {}
+
+ConfigScanner &ConfigScanner::operator=(const ConfigScanner &other) {
+  if (this != &other) {
+    _kernel = other._kernel;
+    _index = other._index;
+  }
+  return (*this);
+}
+
+ConfigScanner::~ConfigScanner() {}
+
+void ConfigScanner::scan(const char *data, size_t size) {
+  size_t count = 0;
+
+  _index.clear();
+  _index.resize(size / 4 + 64);
+  switch (_kernel) {
+#ifdef CONFIG_SCANNER_X86
+  case SCAN_AVX2:
+    count = scanAvx2(data, size, _index);
+    break;
+#ifdef __SSE2__
+  case SCAN_SSE2:
+    count = scanSse2(data, size, _index);
+    break;
+#endif
+#endif
+  default:
+    count = scanScalar(data, size, _index);
+    break;
+  }
+  while (count && _index[count - 1] >= size)
+    --count;
+  _index.resize(count);
+}
+
+void ConfigScanner::release(void) { std::vector<uint32_t>().swap(_index); }
+
+const std::vector<uint32_t> &ConfigScanner::getIndex(void) const {
+  return _index;
+}
+
+ScanKernel ConfigScanner::getKernel(void) const { return _kernel; }
+
+ScanKernel ConfigScanner::detectKernel(void) {
+  if (isSupported(SCAN_AVX2))
+    return SCAN_AVX2;
+  if (isSupported(SCAN_SSE2))
+    return SCAN_SSE2;
+  return SCAN_SCALAR;
+}
+
+bool ConfigScanner::isSupported(ScanKernel kernel) {
+  switch (kernel) {
+  case SCAN_SCALAR:
+    return true;
+#ifdef CONFIG_SCANNER_X86
+#ifdef __SSE2__
+  case SCAN_SSE2:
+    return true;
+#endif
+  case SCAN_AVX2:
+    __builtin_cpu_init();
+    return (__builtin_cpu_supports("avx2") != 0);
+#endif
+  default:
+    return false;
+  }
+}
+
+const char *ConfigScanner::kernelName(ScanKernel kernel) {
+  switch (kernel) {
+  case SCAN_SCALAR:
+    return "scalar";
+  case SCAN_SSE2:
+    return "sse2";
+  case SCAN_AVX2:
+    return "avx2";
+  default:
+    return "auto";
+  }
+}
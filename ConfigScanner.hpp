@@ -0,0 +1,39 @@
+#ifndef CONFIGSCANNER_HPP
+#define CONFIGSCANNER_HPP
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+enum ScanKernel { SCAN_AUTO, SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2 };
+
+// First lexing stage, in the spirit of simdjson: the buffer is classified
+// 64 bytes at a time and every position the lexer has to look at is recorded
+// ('{', '}', ';', '#', '\n', the first byte of a word and the blank that ends
+// it). ConfigLexer then walks this index instead of the raw bytes.
+class ConfigScanner {
+private:
+  ScanKernel _kernel;
+  std::vector<uint32_t> _index;
+
+public:
+  ConfigScanner(void);
+  ConfigScanner(ScanKernel kernel);
+  ConfigScanner(const ConfigScanner &other);
+  ConfigScanner &operator=(const ConfigScanner &other);
+  ~ConfigScanner();
+
+  // Buffers of 4 GiB or more cannot be indexed with 32-bit positions.
+  static const size_t kMaxInput = 0xffffffffUL;
+
+  void scan(const char *data, size_t size);
+  void release(void);
+  const std::vector<uint32_t> &getIndex(void) const;
+  ScanKernel getKernel(void) const;
+
+  static ScanKernel detectKernel(void);
+  static bool isSupported(ScanKernel kernel);
+  static const char *kernelName(ScanKernel kernel);
+};
+
+#endif
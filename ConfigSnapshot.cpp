@@ -0,0 +1,498 @@
+#include "ConfigSnapshot.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "FileSystem.hpp"
+
+namespace {
+uint64_t checksumOf(const char *data, size_t size) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; ++i)
+    hash = (hash ^ static_cast<unsigned char>(data[i])) * 1099511628211ULL;
+  return hash;
+}
+
+void padTo8(std::string &image) {
+  while (image.size() % 8)
+    image.push_back('\0');
+}
+
+template <typename Record>
+uint32_t appendSection(std::string &image,
+                       const std::vector<Record> &records) {
+  padTo8(image);
+  const size_t offset = image.size();
+  if (!records.empty())
+    image.append(reinterpret_cast<const char *>(&records[0]),
+                 records.size() * sizeof(Record));
+  return static_cast<uint32_t>(offset);
+}
+
+// Every distinct string once; the pool becomes the last section.
+class StringPool {
+private:
+  std::string _bytes;
+  std::map<std::string, SnapshotString> _strings;
+
+public:
+  StringPool(void) : _bytes(), _strings() {}
+
+  SnapshotString add(const std::string &value) {
+    std::map<std::string, SnapshotString>::iterator it =
+        _strings.find(value);
+    if (it != _strings.end())
+      return it->second;
+    if (_bytes.size() + value.size() + 1 > 0xFFFFFFFFUL)
+      throw std::runtime_error("Snapshot is too large");
+    SnapshotString string;
+    string.offset = static_cast<uint32_t>(_bytes.size());
+    string.length = static_cast<uint32_t>(value.size());
+    _bytes.append(value);
+    _bytes.push_back('\0');
+    _strings[value] = string;
+    return string;
+  }
+
+  const std::string &bytes(void) const { return _bytes; }
+};
+
+// Byte order of std::string::compare, which sorted the CGI map.
+int compareText(const StringSpan &left, const StringSpan &right) {
+  const size_t common = std::min(left.length, right.length);
+  const int order = common ? std::memcmp(left.data, right.data, common) : 0;
+  if (order)
+    return order;
+  if (left.length == right.length)
+    return 0;
+  return (left.length < right.length ? -1 : 1);
+}
+
+bool inBounds(uint64_t offset, uint64_t count, uint64_t record,
+              uint64_t size) {
+  return (offset % 8 == 0 && offset <= size && count <= size &&
+          count * record <= size - offset);
+}
+
+// Strings must end inside the pool, on their '\0'.
+bool inPool(const SnapshotString &string, const char *pool, uint32_t bytes) {
+  return (string.offset < bytes && string.length < bytes - string.offset &&
+          pool[string.offset + string.length] == '\0');
+}
+
+bool runInBounds(uint32_t first, uint32_t count, uint32_t total) {
+  return (first <= total && count <= total - first);
+}
+
+// A rename is only durable once the directory holding the new entry is
+// synced too. Filesystems that cannot sync a directory report EINVAL.
+bool syncDirectoryOf(const std::string &path) {
+  const std::string::size_type slash = path.rfind('/');
+  const std::string directory = slash == std::string::npos ? "."
+                                : slash == 0 ? "/"
+                                             : path.substr(0, slash);
+  const int fd = ::open(directory.c_str(), O_RDONLY);
+  if (fd < 0)
+    return (false);
+  const bool synced = fsync(fd) == 0 || errno == EINVAL;
+  ::close(fd);
+  return (synced);
+}
+} // namespace
+
+const char ConfigSnapshot::kMagic[8] = {'W', 'S', 'C', 'O', 'N', 'F', 'S',
+                                        '\0'};
+const uint32_t ConfigSnapshot::kVersion;
+const uint32_t ConfigSnapshot::kByteOrder;
+
+ConfigSnapshot::ConfigSnapshot(void)
+    : _data(NULL), _size(0), _mapping(NULL), _copy(NULL), _header(NULL) {}
+
+ConfigSnapshot::~ConfigSnapshot() { close(); }
+
+std::string
+ConfigSnapshot::compile(const std::vector<WebserverConfig> &servers,
+                        const std::vector<ConfigSource> &sources) {
+  StringPool pool;
+  std::vector<SnapshotSource> source_records;
+  std::vector<SnapshotServer> server_records;
+  std::vector<SnapshotLocation> location_records;
+  std::vector<SnapshotErrorPage> error_records;
+  std::vector<SnapshotCgi> cgi_records;
+
+  for (size_t i = 0; i < sources.size(); ++i) {
+    const FileStamp &stamp = sources[i].stamp;
+    SnapshotSource record;
+    std::memset(&record, 0, sizeof(record));
+    record.path = pool.add(sources[i].path);
+    record.size = stamp.size;
+    record.seconds = stamp.seconds;
+    record.nanoseconds = stamp.nanoseconds;
+    source_records.push_back(record);
+  }
+
+  for (size_t i = 0; i < servers.size(); ++i) {
+    const WebserverConfig &server = servers[i];
+    SnapshotServer record;
+    std::memset(&record, 0, sizeof(record));
+    record.name = pool.add(server.getServerName());
+    record.root = pool.add(server.getRoot());
+    record.index = pool.add(server.getIndex());
+    record.host = server.getHost();
+    record.port = server.getPort();
+    record.autoindex = server.getAutoindex();
+    record.max_body_size = server.getMaxBodySize();
+
+    record.first_error_page = static_cast<uint32_t>(error_records.size());
+    const std::map<short, InternedString> &pages = server.getErrorPages();
+    for (std::map<short, InternedString>::const_iterator it = pages.begin();
+         it != pages.end(); ++it) {
+      if (it->second.str().empty())
+        continue;
+      SnapshotErrorPage page;
+      std::memset(&page, 0, sizeof(page));
+      page.code = it->first;
+      page.path = pool.add(it->second.str());
+      error_records.push_back(page);
+    }
+    record.error_page_count =
+        static_cast<uint32_t>(error_records.size()) - record.first_error_page;
+
+    record.first_location = static_cast<uint32_t>(location_records.size());
+    const std::vector<LocationBlock> &locations = server.getLocationBlocks();
+    for (size_t j = 0; j < locations.size(); ++j) {
+      const LocationBlock &location = locations[j];
+      SnapshotLocation entry;
+      std::memset(&entry, 0, sizeof(entry));
+      entry.path = pool.add(location.getPath());
+      entry.root = pool.add(location.getRoot());
+      entry.index = pool.add(location.getIndex());
+      entry.redirect = pool.add(location.getReturn());
+      entry.alias = pool.add(location.getAlias());
+      entry.max_body_size = location.getMaxBodySize();
+      entry.autoindex = location.getAutoindex();
+      entry.methods = location.getMethods();
+      entry.first_cgi = static_cast<uint32_t>(cgi_records.size());
+      const std::map<std::string, InternedString> &cgi =
+          location.getExtensionToCgiMap();
+      for (std::map<std::string, InternedString>::const_iterator it =
+               cgi.begin();
+           it != cgi.end(); ++it) {
+        SnapshotCgi mapping;
+        mapping.extension = pool.add(it->first);
+        mapping.interpreter = pool.add(it->second.str());
+        cgi_records.push_back(mapping);
+      }
+      entry.cgi_count =
+          static_cast<uint32_t>(cgi_records.size()) - entry.first_cgi;
+      location_records.push_back(entry);
+    }
+    record.location_count =
+        static_cast<uint32_t>(location_records.size()) - record.first_location;
+    server_records.push_back(record);
+  }
+
+  SnapshotHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kMagic, sizeof(header.magic));
+  header.version = kVersion;
+  header.byte_order = kByteOrder;
+  std::string image(sizeof(header), '\0');
+  header.source_count = static_cast<uint32_t>(source_records.size());
+  header.sources = appendSection(image, source_records);
+  header.server_count = static_cast<uint32_t>(server_records.size());
+  header.servers = appendSection(image, server_records);
+  header.location_count = static_cast<uint32_t>(location_records.size());
+  header.locations = appendSection(image, location_records);
+  header.error_page_count = static_cast<uint32_t>(error_records.size());
+  header.error_pages = appendSection(image, error_records);
+  header.cgi_count = static_cast<uint32_t>(cgi_records.size());
+  header.cgis = appendSection(image, cgi_records);
+  padTo8(image);
+  header.string_bytes = static_cast<uint32_t>(pool.bytes().size());
+  header.strings = static_cast<uint32_t>(image.size());
+  image.append(pool.bytes());
+  padTo8(image);
+  if (image.size() > 0xFFFFFFFFUL)
+    throw std::runtime_error("Snapshot is too large");
+
+  header.size = image.size();
+  header.checksum =
+      checksumOf(image.data() + sizeof(header), image.size() - sizeof(header));
+  image.replace(0, sizeof(header), reinterpret_cast<const char *>(&header),
+                sizeof(header));
+  return image;
+}
+
+void ConfigSnapshot::write(const std::string &path,
+                           const std::vector<WebserverConfig> &servers,
+                           const std::vector<ConfigSource> &sources) {
+  const std::string image = compile(servers, sources);
+  const std::string temporary = path + ".tmp";
+  const int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    throw std::runtime_error("Could not write snapshot: " + path);
+  size_t written = 0;
+  while (written < image.size()) {
+    const ssize_t got =
+        ::write(fd, image.data() + written, image.size() - written);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0)
+      break;
+    written += static_cast<size_t>(got);
+  }
+  // Synced before the rename, so a crash never leaves `path` naming a file
+  // whose contents did not reach the disk.
+  const bool synced = written == image.size() && fsync(fd) == 0;
+  if (::close(fd) != 0 || !synced ||
+      std::rename(temporary.c_str(), path.c_str()) != 0) {
+    unlink(temporary.c_str());
+    throw std::runtime_error("Could not write snapshot: " + path);
+  }
+  if (!syncDirectoryOf(path))
+    throw std::runtime_error("Could not write snapshot: " + path);
+}
+
+void ConfigSnapshot::open(const std::string &path) {
+  close();
+  const std::string *memory = FileSystem::current().contents(path);
+  if (memory) {
+    _copy = new uint64_t[memory->size() / 8 + 1];
+    if (!memory->empty())
+      std::memcpy(_copy, memory->data(), memory->size());
+    _data = reinterpret_cast<const char *>(_copy);
+    _size = memory->size();
+  } else {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error("Snapshot not found: " + path);
+    struct stat buffer;
+    if (fstat(fd, &buffer) != 0 || !S_ISREG(buffer.st_mode)) {
+      ::close(fd);
+      throw std::runtime_error("Snapshot not found: " + path);
+    }
+    _size = static_cast<size_t>(buffer.st_size);
+    if (_size) {
+      _mapping = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (_mapping == MAP_FAILED) {
+        _mapping = NULL;
+        ::close(fd);
+        throw std::runtime_error("Snapshot could not be mapped: " + path);
+      }
+      _data = static_cast<const char *>(_mapping);
+    }
+    ::close(fd);
+  }
+  try {
+    _check(path);
+  } catch (...) {
+    close();
+    throw;
+  }
+  const std::string stale = findStaleSource();
+  if (!stale.empty()) {
+    close();
+    throw std::runtime_error("Snapshot is stale: " + stale);
+  }
+}
+
+void ConfigSnapshot::attach(const char *data, size_t size,
+                            const std::string &name) {
+  close();
+  if (reinterpret_cast<uintptr_t>(data) % 8)
+    throw std::runtime_error("Snapshot is not aligned: " + name);
+  _data = data;
+  _size = size;
+  try {
+    _check(name);
+  } catch (...) {
+    close();
+    throw;
+  }
+}
+
+// Every offset and run is checked here once, so the accessors need not.
+void ConfigSnapshot::_check(const std::string &name) {
+  if (!_data || _size < sizeof(SnapshotHeader))
+    throw std::runtime_error("Snapshot is truncated: " + name);
+  const SnapshotHeader &header =
+      *reinterpret_cast<const SnapshotHeader *>(_data);
+  if (std::memcmp(header.magic, kMagic, sizeof(header.magic)))
+    throw std::runtime_error("Not a config snapshot: " + name);
+  if (header.byte_order != kByteOrder)
+    throw std::runtime_error("Snapshot has another byte order: " + name);
+  if (header.version != kVersion)
+    throw std::runtime_error("Snapshot version is not supported: " + name);
+  if (header.size != _size)
+    throw std::runtime_error("Snapshot is truncated: " + name);
+  if (header.checksum != checksumOf(_data + sizeof(header),
+                                    _size - sizeof(header)))
+    throw std::runtime_error("Snapshot is corrupt: " + name);
+
+  const std::runtime_error corrupt("Snapshot is corrupt: " + name);
+  if (!inBounds(header.sources, header.source_count, sizeof(SnapshotSource),
+                _size) ||
+      !inBounds(header.servers, header.server_count, sizeof(SnapshotServer),
+                _size) ||
+      !inBounds(header.locations, header.location_count,
+                sizeof(SnapshotLocation), _size) ||
+      !inBounds(header.error_pages, header.error_page_count,
+                sizeof(SnapshotErrorPage), _size) ||
+      !inBounds(header.cgis, header.cgi_count, sizeof(SnapshotCgi), _size) ||
+      !inBounds(header.strings, header.string_bytes, 1, _size))
+    throw corrupt;
+  const char *pool = _data + header.strings;
+  const uint32_t bytes = header.string_bytes;
+  const SnapshotSource *sources =
+      reinterpret_cast<const SnapshotSource *>(_data + header.sources);
+  for (uint32_t i = 0; i < header.source_count; ++i) {
+    if (!inPool(sources[i].path, pool, bytes))
+      throw corrupt;
+  }
+  const SnapshotServer *servers =
+      reinterpret_cast<const SnapshotServer *>(_data + header.servers);
+  for (uint32_t i = 0; i < header.server_count; ++i) {
+    const SnapshotServer &server = servers[i];
+    if (!inPool(server.name, pool, bytes) ||
+        !inPool(server.root, pool, bytes) ||
+        !inPool(server.index, pool, bytes) ||
+        !runInBounds(server.first_location, server.location_count,
+                     header.location_count) ||
+        !runInBounds(server.first_error_page, server.error_page_count,
+                     header.error_page_count))
+      throw corrupt;
+  }
+  const SnapshotLocation *locations =
+      reinterpret_cast<const SnapshotLocation *>(_data + header.locations);
+  for (uint32_t i = 0; i < header.location_count; ++i) {
+    const SnapshotLocation &location = locations[i];
+    if (!inPool(location.path, pool, bytes) ||
+        !inPool(location.root, pool, bytes) ||
+        !inPool(location.index, pool, bytes) ||
+        !inPool(location.redirect, pool, bytes) ||
+        !inPool(location.alias, pool, bytes) ||
+        !runInBounds(location.first_cgi, location.cgi_count, header.cgi_count))
+      throw corrupt;
+  }
+  const SnapshotErrorPage *pages =
+      reinterpret_cast<const SnapshotErrorPage *>(_data + header.error_pages);
+  for (uint32_t i = 0; i < header.error_page_count; ++i) {
+    if (!inPool(pages[i].path, pool, bytes))
+      throw corrupt;
+  }
+  const SnapshotCgi *cgis =
+      reinterpret_cast<const SnapshotCgi *>(_data + header.cgis);
+  for (uint32_t i = 0; i < header.cgi_count; ++i) {
+    if (!inPool(cgis[i].extension, pool, bytes) ||
+        !inPool(cgis[i].interpreter, pool, bytes))
+      throw corrupt;
+  }
+  _header = &header;
+}
+
+void ConfigSnapshot::close(void) {
+  if (_mapping)
+    munmap(_mapping, _size);
+  delete[] _copy;
+  _mapping = NULL;
+  _copy = NULL;
+  _data = NULL;
+  _size = 0;
+  _header = NULL;
+}
+
+bool ConfigSnapshot::isOpen(void) const { return (_header != NULL); }
+
+std::string ConfigSnapshot::findStaleSource(void) const {
+  for (size_t i = 0; i < getSourceCount(); ++i) {
+    const SnapshotSource &source = getSource(i);
+    const std::string path = text(source.path).str();
+    FileStamp stamp;
+    if (!FileSystem::current().stamp(path, stamp) ||
+        stamp.size != source.size || stamp.seconds != source.seconds ||
+        stamp.nanoseconds != source.nanoseconds)
+      return path;
+  }
+  return "";
+}
+
+const char *ConfigSnapshot::data(void) const { return _data; }
+
+size_t ConfigSnapshot::size(void) const { return _size; }
+
+size_t ConfigSnapshot::getSourceCount(void) const {
+  return _header ? _header->source_count : 0;
+}
+
+const SnapshotSource &ConfigSnapshot::getSource(size_t index) const {
+  return reinterpret_cast<const SnapshotSource *>(_data +
+                                                  _header->sources)[index];
+}
+
+size_t ConfigSnapshot::getServerCount(void) const {
+  return _header ? _header->server_count : 0;
+}
+
+const SnapshotServer &ConfigSnapshot::getServer(size_t index) const {
+  return reinterpret_cast<const SnapshotServer *>(_data +
+                                                  _header->servers)[index];
+}
+
+const SnapshotLocation &
+ConfigSnapshot::getLocation(const SnapshotServer &server, size_t index) const {
+  return reinterpret_cast<const SnapshotLocation *>(
+      _data + _header->locations)[server.first_location + index];
+}
+
+const SnapshotErrorPage *
+ConfigSnapshot::findErrorPage(const SnapshotServer &server, int code) const {
+  const SnapshotErrorPage *pages =
+      reinterpret_cast<const SnapshotErrorPage *>(_data +
+                                                  _header->error_pages) +
+      server.first_error_page;
+  size_t low = 0;
+  size_t high = server.error_page_count;
+  while (low < high) {
+    const size_t middle = low + (high - low) / 2;
+    if (pages[middle].code < code)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  if (low < server.error_page_count && pages[low].code == code)
+    return &pages[low];
+  return NULL;
+}
+
+const SnapshotCgi *ConfigSnapshot::findCgi(const SnapshotLocation &location,
+                                           const StringSpan &extension) const {
+  const SnapshotCgi *mappings =
+      reinterpret_cast<const SnapshotCgi *>(_data + _header->cgis) +
+      location.first_cgi;
+  size_t low = 0;
+  size_t high = location.cgi_count;
+  while (low < high) {
+    const size_t middle = low + (high - low) / 2;
+    if (compareText(text(mappings[middle].extension), extension) < 0)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  if (low < location.cgi_count &&
+      !compareText(text(mappings[low].extension), extension))
+    return &mappings[low];
+  return NULL;
+}
+
+StringSpan ConfigSnapshot::text(const SnapshotString &string) const {
+  return StringSpan(_data + _header->strings + string.offset, string.length);
+}
@@ -0,0 +1,163 @@
+#ifndef CONFIGSNAPSHOT_HPP
+#define CONFIGSNAPSHOT_HPP
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "ParserUtils.hpp"
+#include "WebserverConfig.hpp"
+
+// A validated cluster written out as one block of bytes that is used in
+// place: no pointers, only offsets from the start of the image, so it works
+// wherever it is mapped. Layout (native byte order, recorded in the header):
+//
+//   SnapshotHeader | sources | servers | locations | error pages | CGI
+//   mappings | string pool
+//
+// Each section is an array of the records below, 8-byte aligned. Strings
+// are (offset, length) into the pool, stored once however often they
+// repeat and followed by a '\0'. Servers point at a run of locations and
+// error pages, locations at a run of CGI mappings, sorted by extension.
+
+struct SnapshotString {
+  uint32_t offset;
+  uint32_t length;
+};
+
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order; // kByteOrder as written
+  uint64_t size;       // of the whole image
+  uint64_t checksum;   // FNV-1a of every byte after the header
+  uint32_t source_count;
+  uint32_t sources;
+  uint32_t server_count;
+  uint32_t servers;
+  uint32_t location_count;
+  uint32_t locations;
+  uint32_t error_page_count;
+  uint32_t error_pages;
+  uint32_t cgi_count;
+  uint32_t cgis;
+  uint32_t string_bytes;
+  uint32_t strings;
+};
+
+// A configuration file the snapshot was compiled from, as it was then.
+struct SnapshotSource {
+  SnapshotString path;
+  uint64_t size;
+  int64_t seconds;
+  int64_t nanoseconds;
+};
+
+struct SnapshotServer {
+  SnapshotString name;
+  SnapshotString root;
+  SnapshotString index;
+  uint32_t host; // network byte order, as WebserverConfig::getHost()
+  uint16_t port;
+  uint8_t autoindex;
+  uint8_t reserved;
+  uint64_t max_body_size;
+  uint32_t first_location;
+  uint32_t location_count;
+  uint32_t first_error_page;
+  uint32_t error_page_count;
+};
+
+struct SnapshotLocation {
+  SnapshotString path;
+  SnapshotString root;
+  SnapshotString index;
+  SnapshotString redirect; // return
+  SnapshotString alias;
+  uint64_t max_body_size;
+  uint8_t autoindex;
+  uint8_t methods; // LocationBlock::kMethod* bits
+  uint16_t reserved;
+  uint32_t first_cgi;
+  uint32_t cgi_count;
+  uint32_t reserved2;
+};
+
+struct SnapshotErrorPage {
+  int32_t code;
+  SnapshotString path;
+};
+
+struct SnapshotCgi {
+  SnapshotString extension;
+  SnapshotString interpreter;
+};
+
+// Compiles clusters into images and opens them again. open() maps the file
+// read-only (or takes a copy when the active FileSystem holds it in memory)
+// and checks magic, version, byte order, bounds and checksum before anything
+// is read; the accessors then only index into the mapping.
+class ConfigSnapshot {
+private:
+  const char *_data;
+  size_t _size;
+  void *_mapping;       // munmap'ed on close
+  uint64_t *_copy;      // delete[]'d on close
+  const SnapshotHeader *_header;
+
+  ConfigSnapshot(const ConfigSnapshot &other);
+  ConfigSnapshot &operator=(const ConfigSnapshot &other);
+
+  void _check(const std::string &name);
+
+public:
+  static const char kMagic[8];
+  static const uint32_t kVersion = 1;
+  static const uint32_t kByteOrder = 0x01020304;
+
+  ConfigSnapshot(void);
+  ~ConfigSnapshot();
+
+  // The image of `servers`, with the stamps `sources` had when the parse
+  // read them: a source edited since is reported stale by open(), however
+  // soon the image is written. Throws if the image would not fit 32-bit
+  // offsets.
+  static std::string compile(const std::vector<WebserverConfig> &servers,
+                             const std::vector<ConfigSource> &sources);
+  // compile() written to `path` through a temporary file and rename(2), so
+  // a reader never sees half a snapshot.
+  static void write(const std::string &path,
+                    const std::vector<WebserverConfig> &servers,
+                    const std::vector<ConfigSource> &sources);
+
+  // Throws "Snapshot ...: <path>" when the file is missing, not a snapshot,
+  // of another version or byte order, truncated or corrupt, and "Snapshot
+  // is stale: <source>" when a source's size or mtime changed since.
+  void open(const std::string &path);
+  // The same checks, sources aside, on an image already in memory; `data`
+  // must be 8-byte aligned and outlive the snapshot.
+  void attach(const char *data, size_t size, const std::string &name);
+  void close(void);
+  bool isOpen(void) const;
+  // The first source whose stamp changed since compile(), or "".
+  std::string findStaleSource(void) const;
+
+  const char *data(void) const;
+  size_t size(void) const;
+  size_t getSourceCount(void) const;
+  const SnapshotSource &getSource(size_t index) const;
+  size_t getServerCount(void) const;
+  const SnapshotServer &getServer(size_t index) const;
+  const SnapshotLocation &getLocation(const SnapshotServer &server,
+                                      size_t index) const;
+  // The page configured for `code`, or NULL.
+  const SnapshotErrorPage *findErrorPage(const SnapshotServer &server,
+                                         int code) const;
+  // The interpreter mapped to `extension`, or NULL.
+  const SnapshotCgi *findCgi(const SnapshotLocation &location,
+                             const StringSpan &extension) const;
+  StringSpan text(const SnapshotString &string) const;
+};
+
+#endif
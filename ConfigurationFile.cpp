@@ -1,53 +1,101 @@
 #include "ConfigurationFile.hpp"
 
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
 #include <stdexcept>
+#include <sys/mman.h>
 
-ConfigurationFile::ConfigurationFile() : _filename(""), _size(0) {}
+#include "FileSystem.hpp"
+#include "ProbeCache.hpp"
+
+ConfigurationFile::ConfigurationFile()
+    : _filename(""), _size(0), _data(NULL), _mapped(false), _stamp() {}
 
 ConfigurationFile::ConfigurationFile(const std::string &filename)
-    : _filename(filename), _size(0) {}
+    : _filename(filename), _size(0), _data(NULL), _mapped(false), _stamp() {}
 
+// A copy holds the other's bytes in a buffer of its own. It never reads the
+// file again: offsets into the other's range must stay valid in the copy,
+// even if the file (or the active FileSystem) has changed since.
 ConfigurationFile::ConfigurationFile(const ConfigurationFile &other)
-    : _filename(other._filename), _size(other._size) {}
+    : _filename(other._filename), _size(other._size), _data(NULL),
+      _mapped(false), _stamp(other._stamp) {
+  _copyData(other);
+}
 
 ConfigurationFile &
 ConfigurationFile::operator=(const ConfigurationFile &other) {
   if (this != &other) {
+    unload();
     _filename = other._filename;
     _size = other._size;
+    _stamp = other._stamp;
+    _copyData(other);
   }
   return *this;
 }
 
-ConfigurationFile::~ConfigurationFile() {}
+void ConfigurationFile::_copyData(const ConfigurationFile &other) {
+  if (!other._data || !other._size)
+    return;
+  _data = new char[other._size];
+  std::memcpy(_data, other._data, other._size);
+}
+
+ConfigurationFile::~ConfigurationFile() { unload(); }
 
 std::string ConfigurationFile::getFilename() const { return _filename; }
 
 size_t ConfigurationFile::getSize() const { return _size; }
 
 int ConfigurationFile::getTypePath(const std::string &path) {
-  struct stat buffer;
-  int res;
-
-  res = stat(path.c_str(), &buffer);
-  if (res == 0) {
-    if (S_ISREG(buffer.st_mode))
-      return 1; // Regular file
-    else if (S_ISDIR(buffer.st_mode))
-      return 2; // Directory
-    else
-      return 3; // Other types
-  }
-  return -1;
+  ProbeCache *cache = ProbeCache::active();
+  if (cache)
+    return cache->getTypePath(path);
+  return probeTypePath(path);
 }
 
 int ConfigurationFile::checkFile(const std::string &filepath, int mode) {
-  int accessResult;
+  ProbeCache *cache = ProbeCache::active();
+  if (cache)
+    return cache->checkFile(filepath, mode);
+  return probeFile(filepath, mode);
+}
+
+int ConfigurationFile::getTypeAt(const DirectoryHandle &directory,
+                                 const std::string &relative) {
+  ProbeCache *cache = ProbeCache::active();
+  if (cache)
+    return cache->getTypeAt(directory, relative);
+  return directory.typeOf(relative);
+}
+
+int ConfigurationFile::checkFileAt(const DirectoryHandle &directory,
+                                   const std::string &relative, int mode) {
+  ProbeCache *cache = ProbeCache::active();
+  if (cache)
+    return cache->checkFileAt(directory, relative, mode);
+  return directory.access(relative, mode);
+}
+
+DirectoryHandle ConfigurationFile::openDirectory(const std::string &path) {
+  ProbeCache *cache = ProbeCache::active();
+  if (cache)
+    return cache->openDirectory(path);
+  return DirectoryHandle::open(path);
+}
+
+bool ConfigurationFile::getCurrentDirectory(std::string &path) {
+  return FileSystem::current().currentDirectory(path);
+}
+
+int ConfigurationFile::probeTypePath(const std::string &path) {
+  return FileSystem::current().typeOf(path);
+}
 
-  // access() returns 0 if the requested access is permitted
-  // , -1 otherwise (sets errno)
-  accessResult = access(filepath.c_str(), mode);
-  return accessResult;
+int ConfigurationFile::probeFile(const std::string &filepath, int mode) {
+  return FileSystem::current().access(filepath, mode);
 }
 
 int ConfigurationFile::doesFileExistAndIsReadable(const std::string &filepath,
@@ -69,14 +117,110 @@ int ConfigurationFile::doesFileExistAndIsReadable(const std::string &filepath,
   return (-1);
 }
 
+// A file held by an in-memory backend is copied, so the range outlives the
+// backend like a mapping would.
+void ConfigurationFile::load(void) {
+  unload();
+  const std::string *memory = FileSystem::current().contents(_filename);
+  if (memory) {
+    // Stamped first: a write racing the copy leaves an older stamp, which
+    // only makes the copy look stale.
+    FileSystem::current().stamp(_filename, _stamp);
+    if (!memory->empty()) {
+      _data = new char[memory->size()];
+      std::memcpy(_data, memory->data(), memory->size());
+    }
+    _size = memory->size();
+    return;
+  }
+  int fd = open(_filename.c_str(), O_RDONLY);
+  if (fd == -1)
+    throw std::runtime_error("Could not open file: " + _filename);
+  struct stat info;
+  if (fstat(fd, &info) == -1) {
+    close(fd);
+    throw std::runtime_error("Could not open file: " + _filename);
+  }
+  _stamp.size = static_cast<size_t>(info.st_size);
+  _stamp.seconds = info.st_mtim.tv_sec;
+  _stamp.nanoseconds = info.st_mtim.tv_nsec;
+  _size = 0;
+  if (S_ISREG(info.st_mode) && info.st_size > 0) {
+    void *map = mmap(NULL, static_cast<size_t>(info.st_size), PROT_READ,
+                     MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+      _data = static_cast<char *>(map);
+      _size = static_cast<size_t>(info.st_size);
+      _mapped = true;
+      close(fd);
+      return;
+    }
+  }
+  try {
+    _readWhole(fd, S_ISREG(info.st_mode) ? static_cast<size_t>(info.st_size)
+                                         : 0);
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+  close(fd);
+}
+
+// Fallback for files mmap refuses (pipes, procfs): one read() into a buffer
+// sized from fstat, growing only if the file turns out to be longer.
+void ConfigurationFile::_readWhole(int fd, size_t hint) {
+  size_t capacity = hint ? hint : 4096;
+  char *buffer = new char[capacity];
+  size_t length = 0;
+  for (;;) {
+    if (length == capacity) {
+      char *grown = new char[capacity * 2];
+      std::memcpy(grown, buffer, length);
+      delete[] buffer;
+      buffer = grown;
+      capacity *= 2;
+    }
+    ssize_t count = read(fd, buffer + length, capacity - length);
+    if (count == -1 && errno == EINTR)
+      continue;
+    if (count == -1) {
+      delete[] buffer;
+      throw std::runtime_error("Could not read file: " + _filename);
+    }
+    if (count == 0)
+      break;
+    length += static_cast<size_t>(count);
+  }
+  if (!length) {
+    delete[] buffer;
+    return;
+  }
+  _data = buffer;
+  _size = length;
+  _mapped = false;
+}
+
+void ConfigurationFile::unload(void) {
+  if (_data) {
+    if (_mapped)
+      munmap(_data, _size);
+    else
+      delete[] _data;
+  }
+  _data = NULL;
+  _mapped = false;
+}
+
+const char *ConfigurationFile::data(void) const { return _data; }
+
+const FileStamp &ConfigurationFile::getStamp(void) const { return _stamp; }
+
 std::string
 ConfigurationFile::getFileContent(const std::string &filepath) const {
-  std::ifstream fileStream(filepath.c_str());
-  std::stringstream buffer;
-  if (!fileStream.is_open()) {
-    throw std::runtime_error("Could not open file: " +
-                             filepath); // ToDo : To optimized later
-  }
-  buffer << fileStream.rdbuf();
-  return buffer.str();
+  ConfigurationFile file(filepath);
+  file.load();
+  if (!file.data())
+    return std::string();
+  return std::string(file.data(), file.getSize());
 }
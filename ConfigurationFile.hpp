@@ -1,17 +1,23 @@
 #ifndef CONFIGURATIONFILE_HPP
 #define CONFIGURATIONFILE_HPP
 
-#include <fstream>
 #include <iostream>
-#include <sstream>
 #include <string>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "FileSystem.hpp"
+
 class ConfigurationFile {
 private:
   std::string _filename;
   size_t _size;
+  char *_data;
+  bool _mapped;
+  FileStamp _stamp;
+
+  void _readWhole(int fd, size_t hint);
+  void _copyData(const ConfigurationFile &other);
 
 public:
   ConfigurationFile();
@@ -23,9 +29,30 @@ public:
   std::string getFilename() const;
   size_t getSize() const;
 
+  // Maps the file read-only (falls back to one read() into an fstat-sized
+  // buffer when mmap is not possible), or copies it from the active
+  // in-memory FileSystem. The range stays valid until unload().
+  void load(void);
+  void unload(void);
+  const char *data(void) const;
+  // The file's stamp as of the bytes load() read, taken from the same
+  // descriptor; a copy keeps it.
+  const FileStamp &getStamp(void) const;
+
   // Utils functions
+  // Both answer from the thread's active ProbeCache when there is one.
   static int getTypePath(const std::string &path);
   static int checkFile(const std::string &filepath, int mode);
+  // `relative` below an opened root; see DirectoryHandle.
+  static int getTypeAt(const DirectoryHandle &directory,
+                       const std::string &relative);
+  static int checkFileAt(const DirectoryHandle &directory,
+                         const std::string &relative, int mode);
+  static DirectoryHandle openDirectory(const std::string &path);
+  static bool getCurrentDirectory(std::string &path);
+  // Uncached stat()/access() through the active FileSystem.
+  static int probeTypePath(const std::string &path);
+  static int probeFile(const std::string &filepath, int mode);
   static int doesFileExistAndIsReadable(const std::string &filepath,
                                         const std::string &index);
   std::string getFileContent(const std::string &filepath) const;
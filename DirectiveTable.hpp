@@ -0,0 +1,84 @@
+#ifndef DIRECTIVETABLE_HPP
+#define DIRECTIVETABLE_HPP
+
+#include <cstddef>
+#include <stdexcept>
+
+#include "ParserUtils.hpp"
+
+// Entries that may appear more than once in a block use this bit.
+static const int kRepeatable = -1;
+static const size_t kDirectiveSlots = 32;
+
+// Hash over length plus the first, middle and last byte. It is collision
+// free for the directive names we know (server and location scope); a new
+// name that collides only costs the lookups that land on it one more probe.
+inline size_t directiveHash(const StringSpan &word) {
+  if (word.empty())
+    return 0;
+  const unsigned char *bytes =
+      reinterpret_cast<const unsigned char *>(word.data);
+  return (word.length + bytes[0] + 4U * bytes[word.length - 1] +
+          13U * bytes[word.length / 2]) &
+         (kDirectiveSlots - 1);
+}
+
+// Maps a directive token to its entry with one hash and, without collisions,
+// one compare; colliding names take the next free slot (linear probing).
+// Entry needs `name`, `duplicate_bit` and `duplicate_error` members; the
+// table only points into the (static) entry array it was built from, which
+// must leave at least one slot empty (checked at compile time).
+template <typename Entry> class DirectiveTable {
+private:
+  const Entry *_slots[kDirectiveSlots];
+
+public:
+  template <size_t Count> DirectiveTable(const Entry (&entries)[Count]) {
+    // Fails to compile when the entries would fill every slot.
+    typedef char leaves_a_free_slot[Count < kDirectiveSlots ? 1 : -1];
+    (void)sizeof(leaves_a_free_slot);
+    for (size_t i = 0; i < kDirectiveSlots; ++i)
+      _slots[i] = NULL;
+    for (size_t i = 0; i < Count; ++i) {
+      size_t slot = directiveHash(StringSpan(entries[i].name));
+      while (_slots[slot])
+        slot = (slot + 1) & (kDirectiveSlots - 1);
+      _slots[slot] = &entries[i];
+    }
+  }
+
+  DirectiveTable(const DirectiveTable &other) {
+    for (size_t i = 0; i < kDirectiveSlots; ++i)
+      _slots[i] = other._slots[i];
+  }
+
+  DirectiveTable &operator=(const DirectiveTable &other) {
+    for (size_t i = 0; i < kDirectiveSlots; ++i)
+      _slots[i] = other._slots[i];
+    return (*this);
+  }
+
+  ~DirectiveTable() {}
+
+  const Entry *find(const StringSpan &word) const {
+    size_t slot = directiveHash(word);
+    while (_slots[slot]) {
+      if (word == _slots[slot]->name)
+        return _slots[slot];
+      slot = (slot + 1) & (kDirectiveSlots - 1);
+    }
+    return NULL;
+  }
+
+  // Records the directive in the block's bitset, rejecting a second use.
+  static void claim(const Entry &entry, unsigned long &seen) {
+    if (entry.duplicate_bit == kRepeatable)
+      return;
+    const unsigned long bit = 1UL << entry.duplicate_bit;
+    if (seen & bit)
+      throw std::runtime_error(entry.duplicate_error);
+    seen |= bit;
+  }
+};
+
+#endif
@@ -0,0 +1,538 @@
+#include "FileSystem.hpp"
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <glob.h>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ParserUtils.hpp"
+
+namespace {
+__thread FileSystem *t_active_filesystem = NULL;
+
+const PosixFileSystem &posixFileSystem(void) {
+  static const PosixFileSystem filesystem;
+  return filesystem;
+}
+
+// Appends the components of `path` to `resolved`, folding "." and "..".
+void appendPath(std::string &resolved, const std::string &path) {
+  size_t start = 0;
+  while (start <= path.size()) {
+    size_t end = path.find('/', start);
+    if (end == std::string::npos)
+      end = path.size();
+    const size_t length = end - start;
+    if (length == 2 && path[start] == '.' && path[start + 1] == '.') {
+      const size_t slash = resolved.rfind('/');
+      resolved.erase(slash == std::string::npos ? 0 : slash);
+    } else if (length && !(length == 1 && path[start] == '.')) {
+      resolved += '/';
+      resolved.append(path, start, length);
+    }
+    start = end + 1;
+  }
+}
+
+// `relative` as a path below an open directory: joinPaths semantics, so
+// leading slashes stay inside the directory and "" is the directory itself.
+std::string belowDirectory(const std::string &relative) {
+  const size_t start = relative.find_first_not_of('/');
+  if (start == std::string::npos)
+    return ".";
+  return start ? relative.substr(start) : relative;
+}
+
+bool parseMode(const std::string &text, unsigned int &mode) {
+  if (text.empty() || text.size() > 4)
+    return false;
+  mode = 0;
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (text[i] < '0' || text[i] > '7')
+      return false;
+    mode = mode * 8 + static_cast<unsigned int>(text[i] - '0');
+  }
+  return true;
+}
+} // namespace
+
+const int FileSystem::kWorkingDirectory;
+
+bool FileStamp::operator==(const FileStamp &other) const {
+  return (size == other.size && seconds == other.seconds &&
+          nanoseconds == other.nanoseconds);
+}
+
+bool FileStamp::operator!=(const FileStamp &other) const {
+  return !(*this == other);
+}
+
+FileSystem::~FileSystem() {}
+
+int FileSystem::typeOf(const std::string &path) const {
+  return typeAt(kWorkingDirectory, path);
+}
+
+int FileSystem::access(const std::string &path, int mode) const {
+  return accessAt(kWorkingDirectory, path, mode);
+}
+
+FileSystem *FileSystem::active(void) { return t_active_filesystem; }
+
+FileSystem *FileSystem::activate(FileSystem *filesystem) {
+  FileSystem *previous = t_active_filesystem;
+  t_active_filesystem = filesystem;
+  return previous;
+}
+
+const FileSystem &FileSystem::current(void) {
+  if (t_active_filesystem)
+    return *t_active_filesystem;
+  return posixFileSystem();
+}
+
+// Shared state is taken from malloc, not operator new: a handle opened
+// during an arena parse outlives the arena in copies made from it.
+DirectoryHandle::DirectoryHandle(void) : _shared(NULL) {}
+
+DirectoryHandle::DirectoryHandle(const DirectoryHandle &other)
+    : _shared(other._shared) {
+  if (_shared)
+    __sync_fetch_and_add(&_shared->references, 1);
+}
+
+DirectoryHandle &DirectoryHandle::operator=(const DirectoryHandle &other) {
+  if (_shared != other._shared) {
+    if (other._shared)
+      __sync_fetch_and_add(&other._shared->references, 1);
+    _release();
+    _shared = other._shared;
+  }
+  return (*this);
+}
+
+DirectoryHandle::~DirectoryHandle() { _release(); }
+
+void DirectoryHandle::swap(DirectoryHandle &other) {
+  Shared *shared = _shared;
+  _shared = other._shared;
+  other._shared = shared;
+}
+
+void DirectoryHandle::_release(void) {
+  if (!_shared || __sync_sub_and_fetch(&_shared->references, 1))
+    return;
+  if (_shared->directory >= 0)
+    _shared->filesystem->closeDirectory(_shared->directory);
+  std::free(_shared->path);
+  std::free(_shared);
+  _shared = NULL;
+}
+
+DirectoryHandle DirectoryHandle::open(const std::string &path) {
+  DirectoryHandle handle;
+  Shared *shared = static_cast<Shared *>(std::malloc(sizeof(Shared)));
+  char *copy = static_cast<char *>(std::malloc(path.size() + 1));
+  if (!shared || !copy) {
+    std::free(shared);
+    std::free(copy);
+    throw std::bad_alloc();
+  }
+  std::memcpy(copy, path.c_str(), path.size() + 1);
+  shared->filesystem = &FileSystem::current();
+  shared->directory = shared->filesystem->openDirectory(path);
+  shared->references = 1;
+  shared->path = copy;
+  handle._shared = shared;
+  return handle;
+}
+
+// The path a probe of `relative` stands for when there is no open
+// directory to go through; an empty handle is the working directory.
+std::string DirectoryHandle::_fallback(const std::string &relative) const {
+  return _shared ? join(relative) : relative;
+}
+
+const FileSystem &DirectoryHandle::_filesystem(void) const {
+  return _shared ? *_shared->filesystem : FileSystem::current();
+}
+
+bool DirectoryHandle::empty(void) const { return !_shared; }
+
+bool DirectoryHandle::isOpen(void) const {
+  return (_shared && _shared->directory >= 0);
+}
+
+int DirectoryHandle::getDescriptor(void) const {
+  return _shared ? _shared->directory : -1;
+}
+
+std::string DirectoryHandle::getPath(void) const {
+  return _shared ? _shared->path : "";
+}
+
+std::string DirectoryHandle::join(const std::string &relative) const {
+  return joinPaths(getPath(), relative);
+}
+
+int DirectoryHandle::typeOf(const std::string &relative) const {
+  if (!isOpen())
+    return _filesystem().typeOf(_fallback(relative));
+  return _shared->filesystem->typeAt(_shared->directory,
+                                     belowDirectory(relative));
+}
+
+int DirectoryHandle::access(const std::string &relative, int mode) const {
+  if (!isOpen())
+    return _filesystem().access(_fallback(relative), mode);
+  return _shared->filesystem->accessAt(_shared->directory,
+                                       belowDirectory(relative), mode);
+}
+
+int DirectoryHandle::openFile(const std::string &relative) const {
+  if (!isOpen())
+    return -1;
+  return _shared->filesystem->openAt(_shared->directory,
+                                     belowDirectory(relative));
+}
+
+PosixFileSystem::PosixFileSystem(void) {}
+
+PosixFileSystem::PosixFileSystem(const PosixFileSystem &other)
+    : FileSystem(other) {}
+
+PosixFileSystem &PosixFileSystem::operator=(const PosixFileSystem &other) {
+  (void)other;
+  return (*this);
+}
+
+PosixFileSystem::~PosixFileSystem() {}
+
+int PosixFileSystem::openDirectory(const std::string &path) const {
+  return ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+void PosixFileSystem::closeDirectory(int directory) const {
+  if (directory >= 0)
+    close(directory);
+}
+
+int PosixFileSystem::typeAt(int directory, const std::string &relative) const {
+  struct stat buffer;
+
+  if (relative.empty() ||
+      fstatat(directory == kWorkingDirectory ? AT_FDCWD : directory,
+              relative.c_str(), &buffer, 0) != 0)
+    return -1;
+  if (S_ISREG(buffer.st_mode))
+    return 1; // Regular file
+  if (S_ISDIR(buffer.st_mode))
+    return 2; // Directory
+  return 3;   // Other types
+}
+
+int PosixFileSystem::accessAt(int directory, const std::string &relative,
+                              int mode) const {
+  if (relative.empty())
+    return -1;
+  return faccessat(directory == kWorkingDirectory ? AT_FDCWD : directory,
+                   relative.c_str(), mode, 0);
+}
+
+int PosixFileSystem::openAt(int directory, const std::string &relative) const {
+  return openat(directory == kWorkingDirectory ? AT_FDCWD : directory,
+                relative.c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+bool PosixFileSystem::currentDirectory(std::string &path) const {
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd, sizeof(cwd)))
+    return false;
+  path = cwd;
+  return true;
+}
+
+const std::string *PosixFileSystem::contents(const std::string &path) const {
+  (void)path;
+  return NULL;
+}
+
+bool PosixFileSystem::stamp(const std::string &path, FileStamp &stamp) const {
+  struct stat buffer;
+  if (stat(path.c_str(), &buffer) != 0 || !S_ISREG(buffer.st_mode))
+    return false;
+  stamp.size = static_cast<size_t>(buffer.st_size);
+  stamp.seconds = buffer.st_mtim.tv_sec;
+  stamp.nanoseconds = buffer.st_mtim.tv_nsec;
+  return true;
+}
+
+void PosixFileSystem::glob(const std::string &pattern,
+                           std::vector<std::string> &paths) const {
+  glob_t matches;
+  if (::glob(pattern.c_str(), 0, NULL, &matches) != 0) {
+    globfree(&matches);
+    return;
+  }
+  for (size_t i = 0; i < matches.gl_pathc; ++i) {
+    if (typeOf(matches.gl_pathv[i]) == 1)
+      paths.push_back(matches.gl_pathv[i]);
+  }
+  globfree(&matches);
+}
+
+MemoryFileSystem::MemoryFileSystem(void)
+    : _nodes(), _cwd("/"), _next_version(0), _directories(),
+      _next_directory(0) {
+  pthread_mutex_init(&_lock, NULL);
+  _insert("/", 2, 0755);
+}
+
+// Open directory handles belong to the original; a copy starts with none.
+MemoryFileSystem::MemoryFileSystem(const MemoryFileSystem &other)
+    : FileSystem(other), _nodes(other._nodes), _cwd(other._cwd),
+      _next_version(other._next_version), _directories(), _next_directory(0) {
+  pthread_mutex_init(&_lock, NULL);
+}
+
+MemoryFileSystem &MemoryFileSystem::operator=(const MemoryFileSystem &other) {
+  if (this != &other) {
+    _nodes = other._nodes;
+    _cwd = other._cwd;
+    _next_version = other._next_version;
+  }
+  return (*this);
+}
+
+MemoryFileSystem::~MemoryFileSystem() { pthread_mutex_destroy(&_lock); }
+
+std::string MemoryFileSystem::resolve(const std::string &path,
+                                      int directory) const {
+  std::string resolved;
+  if (path.empty() || path[0] != '/') {
+    if (directory == kWorkingDirectory) {
+      appendPath(resolved, _cwd);
+    } else {
+      pthread_mutex_lock(&_lock);
+      std::map<int, std::string>::const_iterator it =
+          _directories.find(directory);
+      const bool known = (it != _directories.end());
+      if (known)
+        resolved = it->second;
+      pthread_mutex_unlock(&_lock);
+      if (!known)
+        return "";
+    }
+  }
+  appendPath(resolved, path);
+  if (resolved.empty())
+    resolved = "/";
+  return resolved;
+}
+
+// Like stat(2), an empty path is missing and a trailing slash only names a
+// directory.
+const MemoryFileSystem::Node *
+MemoryFileSystem::_find(int directory, const std::string &path) const {
+  if (path.empty())
+    return NULL;
+  const std::string resolved = resolve(path, directory);
+  if (resolved.empty())
+    return NULL;
+  std::map<std::string, Node>::const_iterator it = _nodes.find(resolved);
+  if (it == _nodes.end())
+    return NULL;
+  if (path[path.size() - 1] == '/' && it->second.type != 2)
+    return NULL;
+  return &it->second;
+}
+
+MemoryFileSystem::Node &MemoryFileSystem::_insert(const std::string &path,
+                                                  int type,
+                                                  unsigned int mode) {
+  const std::string resolved = resolve(path);
+  const size_t slash = resolved.rfind('/');
+  if (resolved != "/") {
+    const std::string parent = slash ? resolved.substr(0, slash) : "/";
+    std::map<std::string, Node>::const_iterator it = _nodes.find(parent);
+    if (it == _nodes.end())
+      _insert(parent, 2, 0755);
+    else if (it->second.type != 2)
+      throw std::runtime_error("Not a directory: " + parent);
+  }
+  Node &node = _nodes[resolved];
+  node.type = type;
+  node.mode = mode;
+  node.content.clear();
+  node.version = ++_next_version;
+  return node;
+}
+
+void MemoryFileSystem::addDirectory(const std::string &path,
+                                    unsigned int mode) {
+  _insert(path, 2, mode);
+}
+
+void MemoryFileSystem::addFile(const std::string &path,
+                               const std::string &content, unsigned int mode) {
+  _insert(path, 1, mode).content = content;
+}
+
+void MemoryFileSystem::addOther(const std::string &path, unsigned int mode) {
+  _insert(path, 3, mode);
+}
+
+void MemoryFileSystem::setCurrentDirectory(const std::string &path) {
+  const Node *node = _find(kWorkingDirectory, path);
+  if (!node)
+    addDirectory(path);
+  else if (node->type != 2)
+    throw std::runtime_error("Not a directory: " + path);
+  _cwd = resolve(path);
+}
+
+void MemoryFileSystem::loadManifest(const std::string &manifest) {
+  std::istringstream lines(manifest);
+  std::string line;
+  size_t number = 0;
+  while (std::getline(lines, line)) {
+    ++number;
+    const size_t comment = line.find('#');
+    if (comment != std::string::npos)
+      line.erase(comment);
+    std::istringstream fields(line);
+    std::string kind;
+    std::string path;
+    std::string mode_text;
+    std::string extra;
+    if (!(fields >> kind))
+      continue;
+    std::stringstream where;
+    where << "Invalid filesystem manifest line " << number;
+    unsigned int mode = (kind == "dir") ? 0755 : 0644;
+    if (!(fields >> path))
+      throw std::runtime_error(where.str());
+    if (fields >> mode_text && (kind == "cwd" || !parseMode(mode_text, mode)))
+      throw std::runtime_error(where.str());
+    if (fields >> extra)
+      throw std::runtime_error(where.str());
+    if (kind == "dir")
+      addDirectory(path, mode);
+    else if (kind == "file")
+      addFile(path, "", mode);
+    else if (kind == "other")
+      addOther(path, mode);
+    else if (kind == "cwd")
+      setCurrentDirectory(path);
+    else
+      throw std::runtime_error(where.str());
+  }
+}
+
+size_t MemoryFileSystem::size(void) const { return _nodes.size(); }
+
+int MemoryFileSystem::openDirectory(const std::string &path) const {
+  const Node *node = _find(kWorkingDirectory, path);
+  if (!node || node->type != 2)
+    return -1;
+  const std::string resolved = resolve(path);
+  pthread_mutex_lock(&_lock);
+  const int directory = _next_directory++;
+  _directories[directory] = resolved;
+  pthread_mutex_unlock(&_lock);
+  return directory;
+}
+
+void MemoryFileSystem::closeDirectory(int directory) const {
+  pthread_mutex_lock(&_lock);
+  _directories.erase(directory);
+  pthread_mutex_unlock(&_lock);
+}
+
+int MemoryFileSystem::typeAt(int directory,
+                             const std::string &relative) const {
+  const Node *node = _find(directory, relative);
+  return node ? node->type : -1;
+}
+
+int MemoryFileSystem::accessAt(int directory, const std::string &relative,
+                               int mode) const {
+  const Node *node = _find(directory, relative);
+  if (!node)
+    return -1;
+  const unsigned int wanted = static_cast<unsigned int>(mode) & 07;
+  return ((node->mode >> 6) & wanted) == wanted ? 0 : -1;
+}
+
+int MemoryFileSystem::openAt(int directory,
+                             const std::string &relative) const {
+  (void)directory;
+  (void)relative;
+  return -1;
+}
+
+bool MemoryFileSystem::currentDirectory(std::string &path) const {
+  path = _cwd;
+  return true;
+}
+
+const std::string *MemoryFileSystem::contents(const std::string &path) const {
+  const Node *node = _find(kWorkingDirectory, path);
+  return (node && node->type == 1) ? &node->content : NULL;
+}
+
+bool MemoryFileSystem::stamp(const std::string &path, FileStamp &stamp) const {
+  const Node *node = _find(kWorkingDirectory, path);
+  if (!node || node->type != 1)
+    return false;
+  stamp.size = node->content.size();
+  stamp.seconds = static_cast<time_t>(node->version);
+  stamp.nanoseconds = 0;
+  return true;
+}
+
+// Matches against the resolved tree, then spells each hit the way glob(3)
+// would: the pattern's own directory when only the last component has
+// wildcards, else relative to the working directory.
+void MemoryFileSystem::glob(const std::string &pattern,
+                            std::vector<std::string> &paths) const {
+  if (pattern.empty())
+    return;
+  const std::string resolved = resolve(pattern);
+  const size_t wildcard = pattern.find_first_of("*?[");
+  const size_t slash = pattern.rfind('/');
+  const bool last_only =
+      (wildcard == std::string::npos || slash == std::string::npos ||
+       wildcard > slash);
+  const std::string prefix =
+      slash == std::string::npos ? "" : pattern.substr(0, slash + 1);
+  for (std::map<std::string, Node>::const_iterator it = _nodes.begin();
+       it != _nodes.end(); ++it) {
+    if (it->second.type != 1 ||
+        fnmatch(resolved.c_str(), it->first.c_str(),
+                FNM_PATHNAME | FNM_PERIOD) != 0)
+      continue;
+    if (last_only) {
+      paths.push_back(prefix + it->first.substr(it->first.rfind('/') + 1));
+    } else if (pattern[0] == '/') {
+      paths.push_back(it->first);
+    } else {
+      const std::string base = (_cwd == "/") ? "/" : _cwd + "/";
+      paths.push_back(it->first.compare(0, base.size(), base) == 0
+                          ? it->first.substr(base.size())
+                          : it->first);
+    }
+  }
+}
+
+FileSystemScope::FileSystemScope(FileSystem *filesystem)
+    : _previous(FileSystem::activate(filesystem)) {}
+
+FileSystemScope::~FileSystemScope() { FileSystem::activate(_previous); }
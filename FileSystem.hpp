@@ -0,0 +1,209 @@
+#ifndef FILESYSTEM_HPP
+#define FILESYSTEM_HPP
+
+#include <ctime>
+#include <map>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+// What a file looked like when it was read: a copy whose size and stamp
+// are unchanged is taken to have the same content.
+struct FileStamp {
+  size_t size;
+  time_t seconds; // mtime; the in-memory backend counts writes instead
+  long nanoseconds;
+
+  bool operator==(const FileStamp &other) const;
+  bool operator!=(const FileStamp &other) const;
+};
+
+// A file a parse read, stamped as it was when its bytes were read.
+struct ConfigSource {
+  std::string path;
+  FileStamp stamp;
+};
+
+// Where validation looks things up. Every probe the parser makes (stat,
+// access, getcwd and reading the configuration itself) goes through the
+// backend activated on the calling thread (see FileSystemScope), or the
+// real one when none is. Backends are only read during a parse, so one
+// instance may serve several threads.
+class FileSystem {
+public:
+  // Directory argument of the *At calls meaning "the working directory".
+  static const int kWorkingDirectory = -100;
+
+  virtual ~FileSystem();
+
+  // 1 regular file, 2 directory, 3 anything else, -1 missing.
+  int typeOf(const std::string &path) const;
+  // access(2) contract: 0 when every bit of `mode` is granted, else -1.
+  int access(const std::string &path, int mode) const;
+
+  // Directories are opened once and probed with paths relative to them
+  // (fstatat/faccessat for the POSIX backend). openDirectory returns -1
+  // when the directory cannot be opened; an absolute `relative` ignores
+  // `directory`, as with the *at(2) calls.
+  virtual int openDirectory(const std::string &path) const = 0;
+  virtual void closeDirectory(int directory) const = 0;
+  virtual int typeAt(int directory, const std::string &relative) const = 0;
+  virtual int accessAt(int directory, const std::string &relative,
+                       int mode) const = 0;
+  // A read-only descriptor for a file below `directory`, or -1 (also when
+  // the backend has no descriptors to give, like the in-memory one).
+  virtual int openAt(int directory, const std::string &relative) const = 0;
+
+  virtual bool currentDirectory(std::string &path) const = 0;
+  // The bytes of a regular file when the backend holds them in memory;
+  // NULL means the file has to be read from disk.
+  virtual const std::string *contents(const std::string &path) const = 0;
+  // False when `path` is not a regular file.
+  virtual bool stamp(const std::string &path, FileStamp &stamp) const = 0;
+  // Appends the regular files matching the glob(7) `pattern`, sorted and
+  // spelled relative to the same place as the pattern. No match adds
+  // nothing.
+  virtual void glob(const std::string &pattern,
+                    std::vector<std::string> &paths) const = 0;
+
+  static FileSystem *active(void);
+  static FileSystem *activate(FileSystem *filesystem);
+  // The active backend, or the POSIX one.
+  static const FileSystem &current(void);
+};
+
+// A directory opened once through the active FileSystem and shared by every
+// copy; the last copy closes it, so the backend must outlive the handle.
+// Paths below it are probed relative to the open directory instead of being
+// walked from the working directory each time. A directory that could not
+// be opened (out of descriptors, say) still answers, by joining paths onto
+// its name.
+class DirectoryHandle {
+private:
+  struct Shared {
+    const FileSystem *filesystem;
+    int directory;
+    int references;
+    char *path;
+  };
+
+  Shared *_shared;
+
+  void _release(void);
+  const FileSystem &_filesystem(void) const;
+  std::string _fallback(const std::string &relative) const;
+
+public:
+  DirectoryHandle(void);
+  DirectoryHandle(const DirectoryHandle &other);
+  DirectoryHandle &operator=(const DirectoryHandle &other);
+  ~DirectoryHandle();
+
+  static DirectoryHandle open(const std::string &path);
+  void swap(DirectoryHandle &other);
+
+  bool empty(void) const;
+  bool isOpen(void) const;
+  // The backend's handle (a descriptor for POSIX), -1 when not open. Kept
+  // for request-time lookups with openat(2).
+  int getDescriptor(void) const;
+  std::string getPath(void) const;
+  // joinPaths(getPath(), relative): what a relative probe stands for.
+  std::string join(const std::string &relative) const;
+
+  // Uncached probes of `relative` below the directory; leading '/' are
+  // dropped, as joinPaths does.
+  int typeOf(const std::string &relative) const;
+  int access(const std::string &relative, int mode) const;
+  int openFile(const std::string &relative) const;
+};
+
+class PosixFileSystem : public FileSystem {
+public:
+  PosixFileSystem(void);
+  PosixFileSystem(const PosixFileSystem &other);
+  PosixFileSystem &operator=(const PosixFileSystem &other);
+  ~PosixFileSystem();
+
+  int openDirectory(const std::string &path) const;
+  void closeDirectory(int directory) const;
+  int typeAt(int directory, const std::string &relative) const;
+  int accessAt(int directory, const std::string &relative, int mode) const;
+  int openAt(int directory, const std::string &relative) const;
+  bool currentDirectory(std::string &path) const;
+  const std::string *contents(const std::string &path) const;
+  bool stamp(const std::string &path, FileStamp &stamp) const;
+  void glob(const std::string &pattern, std::vector<std::string> &paths) const;
+};
+
+// A tree held in memory, e.g. the docroot of a host that is not mounted
+// here. Relative paths resolve against the tree's own working directory;
+// "." and ".." are folded lexically. Permission checks use the owner bits
+// of each entry's mode.
+class MemoryFileSystem : public FileSystem {
+private:
+  struct Node {
+    int type;
+    unsigned int mode;
+    std::string content;
+    unsigned long version; // bumped by every write, stands in for mtime
+  };
+
+  std::map<std::string, Node> _nodes;
+  std::string _cwd;
+  unsigned long _next_version;
+  // Open directory handles; probes may come from several threads.
+  mutable std::map<int, std::string> _directories;
+  mutable int _next_directory;
+  mutable pthread_mutex_t _lock;
+
+  const Node *_find(int directory, const std::string &path) const;
+  Node &_insert(const std::string &path, int type, unsigned int mode);
+
+public:
+  MemoryFileSystem(void);
+  MemoryFileSystem(const MemoryFileSystem &other);
+  MemoryFileSystem &operator=(const MemoryFileSystem &other);
+  ~MemoryFileSystem();
+
+  // Missing parent directories are created with mode 0755.
+  void addDirectory(const std::string &path, unsigned int mode = 0755);
+  void addFile(const std::string &path, const std::string &content,
+               unsigned int mode = 0644);
+  void addOther(const std::string &path, unsigned int mode = 0644);
+  void setCurrentDirectory(const std::string &path);
+  // One entry per line, '#' starts a comment:
+  //   dir <path> [mode]    file <path> [mode]    other <path> [mode]
+  //   cwd <path>
+  // Modes are octal. Files listed this way are empty; addFile fills them.
+  void loadManifest(const std::string &manifest);
+  // Absolute form of `path` taken relative to `directory`.
+  std::string resolve(const std::string &path,
+                      int directory = kWorkingDirectory) const;
+  size_t size(void) const;
+
+  int openDirectory(const std::string &path) const;
+  void closeDirectory(int directory) const;
+  int typeAt(int directory, const std::string &relative) const;
+  int accessAt(int directory, const std::string &relative, int mode) const;
+  int openAt(int directory, const std::string &relative) const;
+  bool currentDirectory(std::string &path) const;
+  const std::string *contents(const std::string &path) const;
+  bool stamp(const std::string &path, FileStamp &stamp) const;
+  void glob(const std::string &pattern, std::vector<std::string> &paths) const;
+};
+
+// Makes `filesystem` the active backend of this thread for the scope.
+class FileSystemScope {
+private:
+  FileSystem *_previous;
+
+  FileSystemScope(const FileSystemScope &other);
+  FileSystemScope &operator=(const FileSystemScope &other);
+
+public:
+  FileSystemScope(FileSystem *filesystem);
+  ~FileSystemScope();
+};
+
+#endif
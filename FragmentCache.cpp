@@ -0,0 +1,141 @@
+#include "FragmentCache.hpp"
+
+#include <set>
+#include <stdexcept>
+
+#include "ConfigurationFile.hpp"
+#include "ParseArena.hpp"
+#include "WorkerPool.hpp"
+
+namespace {
+typedef std::map<std::string, ConfigFragment *> FragmentMap;
+
+// The cache is only read while the workers run; results are merged in
+// afterwards on the calling thread.
+struct FragmentLoad {
+  const std::vector<std::string> *paths;
+  const FragmentMap *cached;
+  FileSystem *filesystem;
+  std::vector<ConfigFragment *> fresh; // NULL: cached copy still current
+  std::vector<std::string> errors;
+};
+
+ConfigFragment *copyFragment(const ConfigFragment &other) {
+  ConfigFragment *fragment = new ConfigFragment(other);
+  fragment->tokens.rebase(fragment->text.data());
+  return fragment;
+}
+} // namespace
+
+FragmentCache::FragmentCache(void) : _fragments(), _loads(0), _hits(0) {}
+
+FragmentCache::FragmentCache(const FragmentCache &other)
+    : _fragments(), _loads(other._loads), _hits(other._hits) {
+  for (FragmentMap::const_iterator it = other._fragments.begin();
+       it != other._fragments.end(); ++it)
+    _fragments[it->first] = copyFragment(*it->second);
+}
+
+FragmentCache &FragmentCache::operator=(const FragmentCache &other) {
+  if (this != &other) {
+    FragmentCache copy(other);
+    clear();
+    _fragments.swap(copy._fragments);
+    _loads = other._loads;
+    _hits = other._hits;
+  }
+  return (*this);
+}
+
+FragmentCache::~FragmentCache() { clear(); }
+
+void FragmentCache::_loadTask(size_t index, void *context) {
+  FragmentLoad &job = *static_cast<FragmentLoad *>(context);
+  FileSystemScope filesystem(job.filesystem);
+  const std::string &path = (*job.paths)[index];
+  const FileSystem &backend = FileSystem::current();
+  FileStamp stamp;
+  if (!backend.stamp(path, stamp)) {
+    job.errors[index] = "Include file not found: " + path;
+    return;
+  }
+  FragmentMap::const_iterator cached = job.cached->find(path);
+  if (cached != job.cached->end() && cached->second->stamp == stamp)
+    return;
+  if (backend.access(path, R_OK) != 0) {
+    job.errors[index] = "Include file is not accessible: " + path;
+    return;
+  }
+  ConfigFragment *fragment = new ConfigFragment();
+  try {
+    ConfigurationFile file(path);
+    file.load();
+    fragment->path = path;
+    fragment->stamp = file.getStamp();
+    if (file.getSize())
+      fragment->text.assign(file.data(), file.getSize());
+    fragment->tokens.tokenize(fragment->text.data(), fragment->text.size());
+    job.fresh[index] = fragment;
+  } catch (const std::exception &e) {
+    delete fragment;
+    job.errors[index] = e.what();
+  }
+}
+
+void FragmentCache::load(const std::vector<std::string> &paths,
+                         size_t threads) {
+  // Outlives the parse, so never allocated from its arena.
+  ArenaScope heap(NULL);
+  std::vector<std::string> unique;
+  std::set<std::string> seen;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if (seen.insert(paths[i]).second)
+      unique.push_back(paths[i]);
+  }
+
+  FragmentLoad job;
+  job.paths = &unique;
+  job.cached = &_fragments;
+  job.filesystem = FileSystem::active();
+  job.fresh.resize(unique.size(), NULL);
+  job.errors.resize(unique.size());
+  WorkerPool(threads).run(unique.size(), &_loadTask, &job);
+
+  const std::string *error = NULL;
+  for (size_t i = 0; i < unique.size(); ++i) {
+    if (!job.errors[i].empty()) {
+      if (!error)
+        error = &job.errors[i];
+      continue;
+    }
+    if (!job.fresh[i]) {
+      ++_hits;
+      continue;
+    }
+    ConfigFragment *&slot = _fragments[unique[i]];
+    delete slot;
+    slot = job.fresh[i];
+    ++_loads;
+  }
+  if (error)
+    throw std::runtime_error(*error);
+}
+
+const ConfigFragment *FragmentCache::find(const std::string &path) const {
+  FragmentMap::const_iterator it = _fragments.find(path);
+  return (it == _fragments.end() ? NULL : it->second);
+}
+
+size_t FragmentCache::size(void) const { return _fragments.size(); }
+
+size_t FragmentCache::getLoads(void) const { return _loads; }
+
+size_t FragmentCache::getHits(void) const { return _hits; }
+
+void FragmentCache::clear(void) {
+  ArenaScope heap(NULL);
+  for (FragmentMap::iterator it = _fragments.begin(); it != _fragments.end();
+       ++it)
+    delete it->second;
+  _fragments.clear();
+}
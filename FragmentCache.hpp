@@ -0,0 +1,51 @@
+#ifndef FRAGMENTCACHE_HPP
+#define FRAGMENTCACHE_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ConfigLexer.hpp"
+#include "FileSystem.hpp"
+
+// One included configuration file, read and tokenized once. The tokens
+// are spans into `text`; `stamp` is the file's as of the read.
+struct ConfigFragment {
+  std::string path;
+  FileStamp stamp;
+  std::string text;
+  ConfigLexer tokens;
+};
+
+// Included files by path, kept across parses: a reload only reads and
+// re-lexes the files whose size or mtime changed. Fragments live on the
+// heap even when the parse that loads them uses an arena.
+class FragmentCache {
+private:
+  std::map<std::string, ConfigFragment *> _fragments;
+  size_t _loads;
+  size_t _hits;
+
+  static void _loadTask(size_t index, void *context);
+
+public:
+  FragmentCache(void);
+  FragmentCache(const FragmentCache &other);
+  FragmentCache &operator=(const FragmentCache &other);
+  ~FragmentCache();
+
+  // Makes every file of `paths` available through find(). Cached fragments
+  // whose stamp still matches are kept; the others are read and tokenized
+  // `threads` at a time (0: one per online CPU). Throws for the first path,
+  // in order, that is missing or unreadable.
+  void load(const std::vector<std::string> &paths, size_t threads);
+  const ConfigFragment *find(const std::string &path) const;
+  size_t size(void) const;
+  // Files read and tokenized, and reuses of a cached fragment, since the
+  // cache was created.
+  size_t getLoads(void) const;
+  size_t getHits(void) const;
+  void clear(void);
+};
+
+#endif
@@ -0,0 +1,173 @@
+#include "IncludeExpander.hpp"
+
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+
+namespace {
+bool atDirective(const ConfigLexer &tokens, size_t index) {
+  return (index == 0 || !tokens.isWord(index - 1) ||
+          tokens.isTerminated(index - 1));
+}
+
+// The include directives of `tokens` that apply when the file is spliced
+// `depth` blocks deep: (token index, depth at the directive).
+void findSites(const ConfigLexer &tokens, size_t depth,
+               std::vector<std::pair<size_t, size_t> > &sites) {
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    if (tokens.type(i) == TOKEN_BLOCK_START) {
+      ++depth;
+    } else if (tokens.type(i) == TOKEN_BLOCK_END) {
+      if (depth)
+        --depth;
+    } else if (depth <= 1 && tokens.equals(i, "include") &&
+               atDirective(tokens, i)) {
+      if (i + 1 >= tokens.size() || !tokens.isWord(i + 1) ||
+          !tokens.isTerminated(i + 1))
+        throw std::runtime_error("Wrong syntax: include");
+      sites.push_back(std::make_pair(i, depth));
+      ++i;
+    }
+  }
+}
+
+bool isBalanced(const ConfigLexer &tokens) {
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    if (tokens.type(i) != TOKEN_WORD && tokens.match(i) == std::string::npos)
+      return false;
+  }
+  return true;
+}
+} // namespace
+
+const size_t IncludeExpander::kMaxDepth;
+
+IncludeExpander::IncludeExpander(FragmentCache &cache, size_t threads)
+    : _cache(cache), _threads(threads), _matches(), _chain(), _files(),
+      _text(NULL), _tokens(NULL) {}
+
+IncludeExpander::~IncludeExpander() {}
+
+bool IncludeExpander::hasIncludes(const ConfigLexer &tokens) {
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    if (tokens.equals(i, "include"))
+      return true;
+  }
+  return false;
+}
+
+// Files matched by the directive at `index`, globbed once per parse.
+const std::vector<std::string> &
+IncludeExpander::_filesOf(const std::string &includer,
+                          const ConfigLexer &tokens, size_t index) {
+  std::string pattern = trimWhitespace(
+      stripTrailingSemicolon(tokens.text(index + 1), "include")).str();
+  if (pattern.empty())
+    throw std::runtime_error("Wrong syntax: include");
+  const size_t slash = includer.rfind('/');
+  if (pattern[0] != '/' && slash != std::string::npos)
+    pattern = includer.substr(0, slash + 1) + pattern;
+
+  std::map<std::string, std::vector<std::string> >::iterator it =
+      _matches.find(pattern);
+  if (it != _matches.end())
+    return it->second;
+  std::vector<std::string> &files = _matches[pattern];
+  if (pattern.find_first_of("*?[") == std::string::npos)
+    files.push_back(pattern);
+  else
+    FileSystem::current().glob(pattern, files);
+  return files;
+}
+
+void IncludeExpander::_collect(const std::string &path,
+                               const ConfigLexer &tokens, size_t depth,
+                               std::vector<Inclusion> &found) {
+  std::vector<std::pair<size_t, size_t> > sites;
+  findSites(tokens, depth, sites);
+  for (size_t i = 0; i < sites.size(); ++i) {
+    const std::vector<std::string> &files =
+        _filesOf(path, tokens, sites[i].first);
+    for (size_t j = 0; j < files.size(); ++j)
+      found.push_back(Inclusion(files[j], sites[i].second));
+  }
+}
+
+void IncludeExpander::_splice(const std::string &path, const char *text,
+                              size_t size, const ConfigLexer &tokens,
+                              size_t depth) {
+  const size_t base = _text->size();
+  _text->insert(_text->end(), text, text + size);
+  std::vector<std::pair<size_t, size_t> > sites;
+  findSites(tokens, depth, sites);
+  size_t copied = 0;
+  for (size_t i = 0; i < sites.size(); ++i) {
+    const size_t index = sites[i].first;
+    _tokens->appendTokens(tokens, copied, index, base);
+    copied = index + 2;
+    const std::vector<std::string> &files = _filesOf(path, tokens, index);
+    for (size_t j = 0; j < files.size(); ++j) {
+      if (std::find(_chain.begin(), _chain.end(), files[j]) != _chain.end())
+        throw std::runtime_error("Include cycle: " + files[j]);
+      if (_chain.size() > kMaxDepth)
+        throw std::runtime_error("Include nesting is too deep: " + files[j]);
+      const ConfigFragment *fragment = _cache.find(files[j]);
+      if (!fragment) {
+        _cache.load(std::vector<std::string>(1, files[j]), 1);
+        fragment = _cache.find(files[j]);
+      }
+      if (!isBalanced(fragment->tokens))
+        throw std::runtime_error("Problem with scope in " + files[j]);
+      if (std::find(_files.begin(), _files.end(), files[j]) == _files.end())
+        _files.push_back(files[j]);
+      _chain.push_back(files[j]);
+      _splice(files[j], fragment->text.data(), fragment->text.size(),
+              fragment->tokens, sites[i].second);
+      _chain.pop_back();
+    }
+  }
+  _tokens->appendTokens(tokens, copied, tokens.size(), base);
+}
+
+void IncludeExpander::expand(const std::string &path, const char *text,
+                             size_t size, const ConfigLexer &tokens,
+                             std::vector<char> &combined,
+                             ConfigLexer &expanded) {
+  // Every file the expansion will need is loaded first, one batch per
+  // nesting level, so the reads and lexing of a level run concurrently.
+  std::vector<Inclusion> level;
+  std::set<Inclusion> seen;
+  _collect(path, tokens, 0, level);
+  for (size_t nesting = 1; !level.empty(); ++nesting) {
+    if (nesting > kMaxDepth)
+      throw std::runtime_error("Include nesting is too deep: " +
+                               level[0].first);
+    std::vector<Inclusion> batch;
+    std::vector<std::string> files;
+    for (size_t i = 0; i < level.size(); ++i) {
+      if (seen.insert(level[i]).second) {
+        batch.push_back(level[i]);
+        files.push_back(level[i].first);
+      }
+    }
+    _cache.load(files, _threads);
+    level.clear();
+    for (size_t i = 0; i < batch.size(); ++i)
+      _collect(batch[i].first, _cache.find(batch[i].first)->tokens,
+               batch[i].second, level);
+  }
+
+  combined.clear();
+  expanded.clear();
+  _files.clear();
+  _text = &combined;
+  _tokens = &expanded;
+  _chain.assign(1, path);
+  _splice(path, text, size, tokens, 0);
+  expanded.rebase(combined.empty() ? "" : &combined[0]);
+  expanded.matchBraces();
+}
+
+const std::vector<std::string> &IncludeExpander::getFiles(void) const {
+  return _files;
+}
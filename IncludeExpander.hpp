@@ -0,0 +1,61 @@
+#ifndef INCLUDEEXPANDER_HPP
+#define INCLUDEEXPANDER_HPP
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ConfigLexer.hpp"
+#include "FragmentCache.hpp"
+
+// Splices the files named by `include <pattern>;` into the token stream of
+// a configuration. The directive is honoured at the top level and in server
+// scope; patterns are glob(7)s, taken relative to the directory of the file
+// that contains them, and a file pattern without wildcards must exist. The
+// included files are loaded through a FragmentCache, one concurrent batch
+// per nesting level, and each must be brace-balanced on its own.
+class IncludeExpander {
+private:
+  typedef std::pair<std::string, size_t> Inclusion; // file, scope depth
+
+  FragmentCache &_cache;
+  size_t _threads;
+  std::map<std::string, std::vector<std::string> > _matches;
+  std::vector<std::string> _chain; // files being spliced, outermost first
+  std::vector<std::string> _files;
+  std::vector<char> *_text;
+  ConfigLexer *_tokens;
+
+  IncludeExpander(const IncludeExpander &other);
+  IncludeExpander &operator=(const IncludeExpander &other);
+
+  const std::vector<std::string> &_filesOf(const std::string &includer,
+                                           const ConfigLexer &tokens,
+                                           size_t index);
+  void _collect(const std::string &path, const ConfigLexer &tokens,
+                size_t depth, std::vector<Inclusion> &found);
+  void _splice(const std::string &path, const char *text, size_t size,
+               const ConfigLexer &tokens, size_t depth);
+
+public:
+  // Nested includes deeper than this are refused (it also ends loops that
+  // spell the same file differently each time).
+  static const size_t kMaxDepth = 16;
+
+  IncludeExpander(FragmentCache &cache, size_t threads);
+  ~IncludeExpander();
+
+  // Whether `tokens` has an include directive worth expanding.
+  static bool hasIncludes(const ConfigLexer &tokens);
+  // Expands `tokens`, lexed from `text` (read from `path`), into the
+  // concatenated text of every file involved and tokens spanning it,
+  // braces matched. Nothing is re-lexed.
+  void expand(const std::string &path, const char *text, size_t size,
+              const ConfigLexer &tokens, std::vector<char> &combined,
+              ConfigLexer &expanded);
+  // Every file the last expand() spliced in, once each, in order.
+  const std::vector<std::string> &getFiles(void) const;
+};
+
+#endif
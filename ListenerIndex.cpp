@@ -0,0 +1,107 @@
+#include "ListenerIndex.hpp"
+
+#include <arpa/inet.h>
+#include <sstream>
+
+namespace {
+const size_t kMinSlots = 16;
+
+uint64_t listenerKey(in_addr_t host, uint16_t port) {
+  return ((static_cast<uint64_t>(host) << 16) | port);
+}
+
+// Fibonacci hashing; the table size is a power of two.
+size_t slotOf(uint64_t key, size_t mask) {
+  const uint64_t mixed = key * 0x9E3779B97F4A7C15ULL;
+  return (static_cast<size_t>(mixed ^ (mixed >> 32)) & mask);
+}
+} // namespace
+
+const size_t ListenerIndex::npos;
+
+ListenerIndex::ListenerIndex(void) : _slots(), _size(0), _probes(0) {}
+
+ListenerIndex::ListenerIndex(const ListenerIndex &other)
+    : _slots(other._slots), _size(other._size), _probes(other._probes) {}
+
+ListenerIndex &ListenerIndex::operator=(const ListenerIndex &other) {
+  if (this != &other) {
+    _slots = other._slots;
+    _size = other._size;
+    _probes = other._probes;
+  }
+  return (*this);
+}
+
+ListenerIndex::~ListenerIndex() {}
+
+size_t ListenerIndex::_find(uint64_t key) const {
+  const size_t mask = _slots.size() - 1;
+  size_t slot = slotOf(key, mask);
+  ++_probes;
+  while (_slots[slot].server != npos && _slots[slot].key != key) {
+    slot = (slot + 1) & mask;
+    ++_probes;
+  }
+  return slot;
+}
+
+void ListenerIndex::_grow(void) {
+  std::vector<Slot> old;
+  old.swap(_slots);
+  Slot empty;
+  empty.key = 0;
+  empty.server = npos;
+  _slots.assign(old.empty() ? kMinSlots : old.size() * 2, empty);
+  for (size_t i = 0; i < old.size(); ++i) {
+    if (old[i].server != npos)
+      _slots[_find(old[i].key)] = old[i];
+  }
+}
+
+void ListenerIndex::reserve(size_t count) {
+  // Kept at most half full, so probe runs stay short.
+  while (_slots.size() < kMinSlots || _slots.size() / 2 < count)
+    _grow();
+}
+
+size_t ListenerIndex::claim(in_addr_t host, uint16_t port, size_t server) {
+  if ((_size + 1) * 2 > _slots.size())
+    _grow();
+  const uint64_t key = listenerKey(host, port);
+  Slot &slot = _slots[_find(key)];
+  if (slot.server != npos)
+    return slot.server;
+  slot.key = key;
+  slot.server = server;
+  ++_size;
+  return npos;
+}
+
+size_t ListenerIndex::find(in_addr_t host, uint16_t port) const {
+  if (_slots.empty())
+    return npos;
+  return _slots[_find(listenerKey(host, port))].server;
+}
+
+size_t ListenerIndex::size(void) const { return _size; }
+
+size_t ListenerIndex::probes(void) const { return _probes; }
+
+void ListenerIndex::clear(void) {
+  std::vector<Slot>().swap(_slots);
+  _size = 0;
+}
+
+std::string ListenerIndex::describe(in_addr_t host, uint16_t port) {
+  char address[INET_ADDRSTRLEN];
+  struct in_addr parsed;
+  parsed.s_addr = host;
+  std::ostringstream out;
+  if (inet_ntop(AF_INET, &parsed, address, sizeof(address)))
+    out << address;
+  else
+    out << host;
+  out << ":" << port;
+  return out.str();
+}
@@ -0,0 +1,51 @@
+#ifndef LISTENERINDEX_HPP
+#define LISTENERINDEX_HPP
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Open-addressing hash of the (host, port) pairs servers listen on, so a
+// clash among n servers is found in O(n) instead of comparing every pair.
+// Each pair remembers the first server that claimed it.
+class ListenerIndex {
+private:
+  struct Slot {
+    uint64_t key;
+    size_t server; // npos when the slot is free
+  };
+
+  std::vector<Slot> _slots;
+  size_t _size;
+  mutable size_t _probes;
+
+  void _grow(void);
+  size_t _find(uint64_t key) const;
+
+public:
+  ListenerIndex(void);
+  ListenerIndex(const ListenerIndex &other);
+  ListenerIndex &operator=(const ListenerIndex &other);
+  ~ListenerIndex();
+
+  static const size_t npos = static_cast<size_t>(-1);
+
+  // Sizes the table for `count` pairs up front.
+  void reserve(size_t count);
+  // Records that `server` listens on host:port, unless another server did
+  // already: that one is returned and nothing is recorded. npos otherwise.
+  size_t claim(in_addr_t host, uint16_t port, size_t server);
+  // The server that claimed host:port, or npos.
+  size_t find(in_addr_t host, uint16_t port) const;
+  size_t size(void) const;
+  // Slots examined by every lookup so far, rehashing included; lets a caller
+  // check that the cost per claim stays flat as the table grows.
+  size_t probes(void) const;
+  void clear(void);
+
+  // "127.0.0.1:8080"; `host` in network byte order, as parsed.
+  static std::string describe(in_addr_t host, uint16_t port);
+};
+
+#endif
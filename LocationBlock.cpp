@@ -1,12 +1,61 @@
 #include "LocationBlock.hpp"
 
+#include <cstring>
+
+namespace {
+// The Allow header of every method set, indexed by mask.
+const char *const kAllowHeaders[] = {
+    "Allow: \r\n",
+    "Allow: GET\r\n",
+    "Allow: POST\r\n",
+    "Allow: GET, POST\r\n",
+    "Allow: DELETE\r\n",
+    "Allow: GET, DELETE\r\n",
+    "Allow: POST, DELETE\r\n",
+    "Allow: GET, POST, DELETE\r\n",
+    "Allow: PUT\r\n",
+    "Allow: GET, PUT\r\n",
+    "Allow: POST, PUT\r\n",
+    "Allow: GET, POST, PUT\r\n",
+    "Allow: DELETE, PUT\r\n",
+    "Allow: GET, DELETE, PUT\r\n",
+    "Allow: POST, DELETE, PUT\r\n",
+    "Allow: GET, POST, DELETE, PUT\r\n",
+    "Allow: HEAD\r\n",
+    "Allow: GET, HEAD\r\n",
+    "Allow: POST, HEAD\r\n",
+    "Allow: GET, POST, HEAD\r\n",
+    "Allow: DELETE, HEAD\r\n",
+    "Allow: GET, DELETE, HEAD\r\n",
+    "Allow: POST, DELETE, HEAD\r\n",
+    "Allow: GET, POST, DELETE, HEAD\r\n",
+    "Allow: PUT, HEAD\r\n",
+    "Allow: GET, PUT, HEAD\r\n",
+    "Allow: POST, PUT, HEAD\r\n",
+    "Allow: GET, POST, PUT, HEAD\r\n",
+    "Allow: DELETE, PUT, HEAD\r\n",
+    "Allow: GET, DELETE, PUT, HEAD\r\n",
+    "Allow: POST, DELETE, PUT, HEAD\r\n",
+    "Allow: GET, POST, DELETE, PUT, HEAD\r\n",
+};
+
+const char *const kMethodNames[] = {"GET", "POST", "DELETE", "PUT", "HEAD"};
+} // namespace
+
+const uint8_t LocationBlock::kMethodGet;
+const uint8_t LocationBlock::kMethodPost;
+const uint8_t LocationBlock::kMethodDelete;
+const uint8_t LocationBlock::kMethodPut;
+const uint8_t LocationBlock::kMethodHead;
+
 LocationBlock::LocationBlock()
-    : _root(""), _path(""), _autoindex(false), _index(""), _return(""),
-      _alias(""), _methods(5, 0), _cgi_extensions(), _cgi_paths(),
+    : _root(), _root_directory(), _path(""), _autoindex(false), _index(),
+      _return(""), _alias(""), _methods(0), _cgi_extensions(), _cgi_paths(),
       _max_body_size(kDefaultMaxBodySize), _extension_to_cgi() {}
 
 LocationBlock::LocationBlock(const LocationBlock &other) {
   _root = other._root;
+  _root_directory = other._root_directory;
   _path = other._path;
   _autoindex = other._autoindex;
   _index = other._index;
@@ -22,6 +71,7 @@ LocationBlock::LocationBlock(const LocationBlock &other) {
 LocationBlock &LocationBlock::operator=(const LocationBlock &other) {
   if (this != &other) {
     _root = other._root;
+    _root_directory = other._root_directory;
     _path = other._path;
     _autoindex = other._autoindex;
     _index = other._index;
@@ -42,44 +92,54 @@ void LocationBlock::setRoot(const std::string &root) {
   if (ConfigurationFile::getTypePath(root) != 2) {
     throw std::runtime_error("root of location is invalid: " + root);
   }
+  _root = InternedString(root);
+  _root_directory = ConfigurationFile::openDirectory(_root.str());
+}
+
+void LocationBlock::setRoot(const InternedString &root,
+                            const DirectoryHandle &directory) {
   _root = root;
+  _root_directory = directory;
 }
+
 void LocationBlock::setPath(const std::string &path) { _path = path; }
 
-void LocationBlock::setMethods(const std::vector<std::string> &methods) {
-  _methods.assign(5, 0); // Reset methods
+void LocationBlock::setMethods(const std::vector<StringSpan> &methods) {
+  _methods = 0;
   for (size_t i = 0; i < methods.size(); ++i) {
-    std::string method = methods[i];
-    if (method == "GET") {
-      _methods[0] = 1;
-    } else if (method == "POST") {
-      _methods[1] = 1;
-    } else if (method == "DELETE") {
-      _methods[2] = 1;
-    } else if (method == "PUT") {
-      _methods[3] = 1;
-    } else if (method == "HEAD") {
-      _methods[4] = 1;
-    } else {
-      throw std::runtime_error("Allow method not supported " + method);
-    }
+    const uint8_t method = methodFromName(methods[i]);
+    if (!method)
+      throw std::runtime_error("Allow method not supported " +
+                               methods[i].str());
+    _methods |= method;
   }
 }
 
-void LocationBlock::setAutoindex(const std::string &autoindex) {
+uint8_t LocationBlock::methodFromName(const StringSpan &name) {
+  for (size_t i = 0; i < sizeof(kMethodNames) / sizeof(kMethodNames[0]); ++i) {
+    if (name == kMethodNames[i])
+      return static_cast<uint8_t>(1U << i);
+  }
+  return 0;
+}
+
+void LocationBlock::setAutoindex(const StringSpan &autoindex) {
   if (autoindex == "on") {
     _autoindex = true;
   } else if (autoindex == "off") {
     _autoindex = false;
   } else {
-    throw std::runtime_error("Autoindex value not supported: " + autoindex);
+    throw std::runtime_error("Autoindex value not supported: " +
+                             autoindex.str());
   }
 }
 
-void LocationBlock::setIndex(const std::string &index) {
-  _index = index;
+void LocationBlock::setIndex(const StringSpan &index) {
+  _index = InternedString(index);
 }
 
+void LocationBlock::setIndex(const InternedString &index) { _index = index; }
+
 void LocationBlock::setReturn(const std::string &ret) {
   _return = ret;
 }
@@ -88,8 +148,10 @@ void LocationBlock::setAlias(const std::string &alias) {
   _alias = alias;
 }
 
-void LocationBlock::setCgiPaths(const std::vector<std::string> &paths) {
-  _cgi_paths = paths;
+void LocationBlock::setCgiPaths(const std::vector<StringSpan> &paths) {
+  _cgi_paths.clear();
+  for (size_t i = 0; i < paths.size(); ++i)
+    _cgi_paths.push_back(InternedString(paths[i]));
 }
 
 void LocationBlock::setCgiExtensions(
@@ -97,70 +159,60 @@ void LocationBlock::setCgiExtensions(
   _cgi_extensions = extensions;
 }
 
-void LocationBlock::setMaxBodySize(const std::string &size_str) {
-  unsigned long size = 0;
-  if (!isAllDigits(size_str)) {
+void LocationBlock::setMaxBodySize(const StringSpan &size_str) {
+  uint64_t size = 0;
+  if (!parseSize(size_str, size)) {
     throw std::runtime_error("Max body size must be a positive integer: " +
-                             size_str);
+                             size_str.str());
   }
-  size = static_cast<unsigned long>(stoiStrict(size_str));
   if (!size) {
     throw std::runtime_error("Max body size must be greater than zero: " +
-                             size_str);
+                             size_str.str());
   }
   _max_body_size = size;
 }
 
-void LocationBlock::setMaxBodySize(unsigned long size) {
+void LocationBlock::setMaxBodySize(uint64_t size) {
   _max_body_size = size;
 }
 
 // Getters for our class members
 
-const std::string &LocationBlock::getRoot() const { return _root; }
+const std::string &LocationBlock::getRoot() const { return _root.str(); }
+
+const DirectoryHandle &LocationBlock::getRootDirectory() const {
+  return _root_directory;
+}
 const std::string &LocationBlock::getPath() const { return _path; }
-const std::string &LocationBlock::getIndex() const { return _index; }
+const std::string &LocationBlock::getIndex() const { return _index.str(); }
 const bool &LocationBlock::getAutoindex() const { return _autoindex; }
 const std::string &LocationBlock::getReturn() const { return _return; }
 const std::string &LocationBlock::getAlias() const { return _alias; }
-const std::vector<short> &LocationBlock::getMethods() const { return _methods; }
+uint8_t LocationBlock::getMethods() const { return _methods; }
 const std::vector<std::string> &LocationBlock::getCgiExtensions() const {
   return _cgi_extensions;
 }
-const std::vector<std::string> &LocationBlock::getCgiPaths() const {
+const std::vector<InternedString> &LocationBlock::getCgiPaths() const {
   return _cgi_paths;
 }
-const unsigned long &LocationBlock::getMaxBodySize() const {
+const uint64_t &LocationBlock::getMaxBodySize() const {
   return _max_body_size;
 }
-const std::map<std::string, std::string> &
+const std::map<std::string, InternedString> &
 LocationBlock::getExtensionToCgiMap() const {
   return _extension_to_cgi;
 }
 
+bool LocationBlock::allowsMethod(uint8_t method) const {
+  return ((_methods & method) != 0);
+}
+
+const char *LocationBlock::getAllowHeader(void) const {
+  return kAllowHeaders[_methods];
+}
+
+// The value of the Allow header: "GET, POST".
 std::string LocationBlock::getPrintMethods(void) const {
-  std::string res;
-  if (_methods[4])
-    res.insert(0, "HEAD");
-  if (_methods[3]) {
-    if (!res.empty())
-      res.insert(0, ", ");
-    res.insert(0, "PUT");
-  }
-  if (_methods[2]) {
-    if (!res.empty())
-      res.insert(0, ", ");
-    res.insert(0, "DELETE");
-  }
-  if (_methods[1]) {
-    if (!res.empty())
-      res.insert(0, ", ");
-    res.insert(0, "POST");
-  }
-  if (_methods[0]) {
-    if (!res.empty())
-      res.insert(0, ", ");
-    res.insert(0, "GET");
-  }
-  return (res);
+  const char *header = getAllowHeader() + std::strlen("Allow: ");
+  return std::string(header, std::strlen(header) - 2);
 }
@@ -2,6 +2,7 @@
 #define LOCATIONBLOCK_HPP
 #include "ConfigurationFile.hpp"
 #include "ParserUtils.hpp"
+#include "StringInterner.hpp"
 #include <iostream>
 #include <map>
 #include <string>
@@ -9,50 +10,74 @@
 
 class LocationBlock {
 private:
-  std::string _root;
+  // Locations that inherit the server's root or index share its copy.
+  InternedString _root;
+  DirectoryHandle _root_directory;
   std::string _path;
   bool _autoindex;
-  std::string _index;
+  InternedString _index;
   std::string _return;
   std::string _alias;
-  std::vector<short> _methods;
+  uint8_t _methods; // kMethod* bits
   std::vector<std::string> _cgi_extensions;
-  std::vector<std::string> _cgi_paths;
+  // Interpreters are interned like roots: every CGI location names the same
+  // few.
+  std::vector<InternedString> _cgi_paths;
 
-  unsigned long _max_body_size;
+  uint64_t _max_body_size;
 
 public:
-  std::map<std::string, std::string> _extension_to_cgi;
+  // Bits of getMethods().
+  static const uint8_t kMethodGet = 1;
+  static const uint8_t kMethodPost = 2;
+  static const uint8_t kMethodDelete = 4;
+  static const uint8_t kMethodPut = 8;
+  static const uint8_t kMethodHead = 16;
+
+  std::map<std::string, InternedString> _extension_to_cgi;
   LocationBlock(void);
   LocationBlock(const LocationBlock &other);
   LocationBlock &operator=(const LocationBlock &other);
   ~LocationBlock();
   // Setter methods for our private members
   void setRoot(const std::string &root);
+  // Takes a root that is already validated and opened, e.g. the server's.
+  void setRoot(const InternedString &root, const DirectoryHandle &directory);
   void setPath(const std::string &path);
-  void setAutoindex(const std::string &autoindex);
-  void setMethods(const std::vector<std::string> &methods);
-  void setIndex(const std::string &index);
+  void setAutoindex(const StringSpan &autoindex);
+  void setMethods(const std::vector<StringSpan> &methods);
+  void setIndex(const StringSpan &index);
+  void setIndex(const InternedString &index);
   void setReturn(const std::string &ret);
   void setAlias(const std::string &alias);
   void setCgiExtensions(const std::vector<std::string> &extensions);
-  void setCgiPaths(const std::vector<std::string> &paths);
-  void setMaxBodySize(const std::string &size);
-  void setMaxBodySize(unsigned long size);
+  void setCgiPaths(const std::vector<StringSpan> &paths);
+  void setMaxBodySize(const StringSpan &size);
+  void setMaxBodySize(uint64_t size);
 
   // Getter methods for our private members
   const std::string &getRoot(void) const;
+  // Open handle on the root, for openat(2)-style lookups below it.
+  const DirectoryHandle &getRootDirectory(void) const;
   const std::string &getPath(void) const;
   const bool &getAutoindex(void) const;
   const std::string &getIndex(void) const;
   const std::string &getReturn(void) const;
   const std::string &getAlias(void) const;
-  const std::vector<short> &getMethods(void) const;
+  uint8_t getMethods(void) const;
+  // True when `method` (one kMethod* bit) is allowed.
+  bool allowsMethod(uint8_t method) const;
+  // The kMethod* bit of "GET", "POST", ...; 0 for anything else.
+  static uint8_t methodFromName(const StringSpan &name);
   const std::vector<std::string> &getCgiExtensions(void) const;
-  const std::vector<std::string> &getCgiPaths(void) const;
-  const std::map<std::string, std::string> &getExtensionToCgiMap(void) const;
-  const unsigned long &getMaxBodySize(void) const;
+  const std::vector<InternedString> &getCgiPaths(void) const;
+  const std::map<std::string, InternedString> &
+  getExtensionToCgiMap(void) const;
+  const uint64_t &getMaxBodySize(void) const;
 
+  // "Allow: GET, POST\r\n", ready for a 405 response. The lines for every
+  // method set are static, so locations hold no copy.
+  const char *getAllowHeader(void) const;
   std::string getPrintMethods(void) const;
 };
 
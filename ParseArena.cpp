@@ -0,0 +1,153 @@
+#include "ParseArena.hpp"
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+namespace {
+const int kMaxArenas = 16;
+const size_t kAlignment = 16;
+
+// Bases of every reserved arena, so operator delete can recognise arena
+// pointers from any thread without touching the arena objects.
+char *volatile g_arena_bases[kMaxArenas];
+volatile int g_live_arenas = 0;
+
+volatile size_t g_generation = 0;
+
+// Set by ArenaHooks.cpp when the program links it.
+bool g_hooks_installed = false;
+
+__thread ParseArena *t_active_arena = NULL;
+__thread AllocationCounters t_counters = {0, 0, 0};
+// This thread's current chunk, valid while the arena keeps the generation
+// it was carved from.
+__thread char *t_chunk_next = NULL;
+__thread char *t_chunk_end = NULL;
+__thread size_t t_chunk_generation = 0;
+
+bool inLiveArena(const void *ptr) {
+  const uintptr_t address = reinterpret_cast<uintptr_t>(ptr);
+  for (int i = 0; i < kMaxArenas; ++i) {
+    const uintptr_t base = reinterpret_cast<uintptr_t>(g_arena_bases[i]);
+    if (base && address - base < ParseArena::kReserve)
+      return true;
+  }
+  return false;
+}
+} // namespace
+
+void *ParseArena::allocateHooked(std::size_t size) {
+  ++t_counters.news;
+  if (t_active_arena) {
+    void *ptr = t_active_arena->allocate(size);
+    if (ptr)
+      return ptr;
+  }
+  ++t_counters.mallocs;
+  return NULL;
+}
+
+bool ParseArena::releaseHooked(const void *ptr) {
+  if (!ptr || (g_live_arenas && inLiveArena(ptr)))
+    return true;
+  ++t_counters.frees;
+  return false;
+}
+
+void ParseArena::installHooks(void) { g_hooks_installed = true; }
+
+bool ParseArena::hooksInstalled(void) { return g_hooks_installed; }
+
+ParseArena::ParseArena(void)
+    : _base(NULL), _used(0), _generation(0), _slot(-1) {}
+
+ParseArena::~ParseArena() { release(); }
+
+bool ParseArena::reserve(void) {
+  if (_base)
+    return true;
+  if (!g_hooks_installed)
+    return false;
+  void *region = mmap(NULL, kReserve, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (region == MAP_FAILED)
+    return false;
+#ifdef MADV_HUGEPAGE
+  // Fewer page faults while the bump pointer walks into fresh memory.
+  madvise(region, kReserve, MADV_HUGEPAGE);
+#endif
+  for (int i = 0; i < kMaxArenas; ++i) {
+    if (__sync_bool_compare_and_swap(&g_arena_bases[i], static_cast<char *>(0),
+                                      static_cast<char *>(region))) {
+      _slot = i;
+      _base = static_cast<char *>(region);
+      _used = 0;
+      _generation = __sync_add_and_fetch(&g_generation, 1);
+      __sync_fetch_and_add(&g_live_arenas, 1);
+      return true;
+    }
+  }
+  munmap(region, kReserve);
+  return false;
+}
+
+void ParseArena::release(void) {
+  if (!_base)
+    return;
+  g_arena_bases[_slot] = NULL;
+  __sync_fetch_and_sub(&g_live_arenas, 1);
+  munmap(_base, kReserve);
+  _base = NULL;
+  _slot = -1;
+  _used = 0;
+  _generation = 0;
+}
+
+// Worker threads of a parallel parse share the arena: each one takes whole
+// chunks from the shared offset and bumps through them without locking.
+void *ParseArena::allocate(size_t size) {
+  if (!_base)
+    return NULL;
+  const size_t rounded =
+      size ? (size + kAlignment - 1) & ~(kAlignment - 1) : kAlignment;
+  if (t_chunk_generation != _generation ||
+      static_cast<size_t>(t_chunk_end - t_chunk_next) < rounded) {
+    const size_t chunk = (rounded > kChunk ? rounded : kChunk);
+    const size_t offset = __sync_fetch_and_add(&_used, chunk);
+    if (offset > kReserve || kReserve - offset < chunk)
+      return NULL;
+    t_chunk_next = _base + offset;
+    t_chunk_end = t_chunk_next + chunk;
+    t_chunk_generation = _generation;
+  }
+  void *ptr = t_chunk_next;
+  t_chunk_next += rounded;
+  return ptr;
+}
+
+bool ParseArena::contains(const void *ptr) const {
+  const uintptr_t address = reinterpret_cast<uintptr_t>(ptr);
+  const uintptr_t base = reinterpret_cast<uintptr_t>(_base);
+  return (_base && address - base < kReserve);
+}
+
+bool ParseArena::isReserved(void) const { return (_base != NULL); }
+
+size_t ParseArena::getUsed(void) const {
+  return (_used < kReserve ? _used : kReserve);
+}
+
+ParseArena *ParseArena::active(void) { return t_active_arena; }
+
+ParseArena *ParseArena::activate(ParseArena *arena) {
+  ParseArena *previous = t_active_arena;
+  t_active_arena = arena;
+  return previous;
+}
+
+AllocationCounters ParseArena::readCounters(void) { return t_counters; }
+
+ArenaScope::ArenaScope(ParseArena *arena)
+    : _previous(ParseArena::activate(arena)) {}
+
+ArenaScope::~ArenaScope() { ParseArena::activate(_previous); }
@@ -0,0 +1,81 @@
+#ifndef PARSEARENA_HPP
+#define PARSEARENA_HPP
+
+#include <cstddef>
+
+// Per-thread tallies kept by the global operator new / delete in
+// ArenaHooks.cpp; they stay at zero in programs that do not link it.
+struct AllocationCounters {
+  size_t news;    // every operator new
+  size_t mallocs; // the ones not served by an arena
+  size_t frees;   // operator delete calls that reached free()
+};
+
+// Bump allocator for everything one parse builds. Global operator new
+// (replaced in ArenaHooks.cpp) is served from the arena activated on the
+// calling thread, operator delete ignores pointers into a live arena, and
+// release() unmaps the whole region at once. Only address space is reserved
+// up front; once it is used up, allocations fall back to malloc.
+//
+// The replacement changes every allocation in the host program, so it is
+// opt-in: only programs that link ArenaHooks.o get it (config_parser with
+// `make ARENA=1`). Without it reserve() fails and parses use the heap.
+//
+// Nothing allocated while an arena is active may outlive its release(): once
+// the region is unmapped, operator delete no longer recognises the pointer
+// and hands it to free(), which corrupts the heap or crashes.
+class ParseArena {
+private:
+  char *_base;
+  size_t _used;
+  size_t _generation;
+  int _slot;
+
+  ParseArena(const ParseArena &other);
+  ParseArena &operator=(const ParseArena &other);
+
+public:
+  static const size_t kReserve = static_cast<size_t>(1) << 30;
+  // Each thread carves its allocations out of a chunk of this size, so the
+  // shared counter is only touched once per chunk.
+  static const size_t kChunk = 64 * 1024;
+
+  ParseArena(void);
+  ~ParseArena();
+
+  // False when no address space (or registry slot) is available; the arena
+  // then stays empty and every allocation goes to malloc.
+  bool reserve(void);
+  void release(void);
+  void *allocate(size_t size);
+  bool contains(const void *ptr) const;
+  bool isReserved(void) const;
+  size_t getUsed(void) const;
+
+  static ParseArena *active(void);
+  static ParseArena *activate(ParseArena *arena);
+  static AllocationCounters readCounters(void);
+
+  // Entry points for the replaced operator new / delete. allocateHooked()
+  // returns NULL when the caller must malloc; releaseHooked() returns true
+  // when the pointer must not be freed.
+  static void *allocateHooked(size_t size);
+  static bool releaseHooked(const void *ptr);
+  static void installHooks(void);
+  static bool hooksInstalled(void);
+};
+
+// Routes operator new on this thread to `arena` for the scope's lifetime.
+class ArenaScope {
+private:
+  ParseArena *_previous;
+
+  ArenaScope(const ArenaScope &other);
+  ArenaScope &operator=(const ArenaScope &other);
+
+public:
+  ArenaScope(ParseArena *arena);
+  ~ArenaScope();
+};
+
+#endif
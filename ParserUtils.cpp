@@ -1,39 +1,154 @@
 #include "ParserUtils.hpp"
 
+#include <cstring>
+
+StringSpan::StringSpan(void) : data(""), length(0) {}
+
+StringSpan::StringSpan(const char *str) : data(str), length(std::strlen(str)) {}
+
+StringSpan::StringSpan(const std::string &str)
+    : data(str.data()), length(str.size()) {}
+
+StringSpan::StringSpan(const char *str, size_t len) : data(str), length(len) {}
+
+bool StringSpan::empty(void) const { return (length == 0); }
+
+char StringSpan::back(void) const { return (length ? data[length - 1] : '\0'); }
+
+bool StringSpan::operator==(const char *word) const {
+  size_t i = 0;
+  while (i < length && word[i] && word[i] == data[i])
+    ++i;
+  return (i == length && word[i] == '\0');
+}
+
+bool StringSpan::operator!=(const char *word) const { return !(*this == word); }
+
+bool StringSpan::contains(const char *needle) const {
+  const size_t needle_length = std::strlen(needle);
+  if (needle_length > length)
+    return false;
+  for (size_t i = 0; i + needle_length <= length; ++i) {
+    if (std::memcmp(data + i, needle, needle_length) == 0)
+      return true;
+  }
+  return false;
+}
+
+std::string StringSpan::str(void) const { return std::string(data, length); }
+
 bool isAllDigits(const std::string &value) {
-  for (size_t i = 0; i < value.length(); ++i) {
-    if (!std::isdigit(static_cast<unsigned char>(value[i]))) {
+  return isAllDigits(StringSpan(value));
+}
+
+bool isAllDigits(const StringSpan &value) {
+  for (size_t i = 0; i < value.length; ++i) {
+    if (!std::isdigit(static_cast<unsigned char>(value.data[i]))) {
       return false;
     }
   }
   return true;
 }
 
+bool parseUnsigned(const StringSpan &text, uint64_t limit, uint64_t &value) {
+  if (text.empty() || text.length > 20)
+    return false;
+  uint64_t result = 0;
+  for (size_t i = 0; i < text.length; ++i) {
+    const unsigned int digit =
+        static_cast<unsigned char>(text.data[i]) - static_cast<unsigned>('0');
+    if (digit > 9)
+      return false;
+    // result * 10 + digit <= limit, rearranged so nothing can wrap.
+    if (result > (limit - digit) / 10)
+      return false;
+    result = result * 10 + digit;
+  }
+  value = result;
+  return true;
+}
+
+bool parseSize(const StringSpan &text, uint64_t &value) {
+  unsigned int shift = 0;
+  switch (text.back()) {
+  case 'k':
+  case 'K':
+    shift = 10;
+    break;
+  case 'm':
+  case 'M':
+    shift = 20;
+    break;
+  case 'g':
+  case 'G':
+    shift = 30;
+    break;
+  default:
+    break;
+  }
+  const StringSpan digits(text.data, text.length - (shift ? 1 : 0));
+  const uint64_t limit = ~static_cast<uint64_t>(0) >> shift;
+  uint64_t result = 0;
+  if (!parseUnsigned(digits, limit, result))
+    return false;
+  value = result << shift;
+  return true;
+}
+
 int stoiStrict(const std::string &str) {
   if (!isAllDigits(str)) {
     throw std::invalid_argument("Invalid integer string: " + str);
   }
-  std::stringstream ss(str);
-  long value = 0;
-  ss >> value;
-
-  if (ss.fail() || value > std::numeric_limits<int>::max()) {
+  uint64_t value = 0;
+  if (!parseUnsigned(StringSpan(str),
+                     static_cast<uint64_t>(std::numeric_limits<int>::max()),
+                     value)) {
     throw std::invalid_argument("Value is out of bounds: " + str);
   }
   return (static_cast<int>(value));
 }
 
+// Reads leading hex digits (optionally after "0x") and stops at the first
+// other character, as the stream extraction it replaces did.
 unsigned int hexToUint(const std::string &hex) {
+  size_t i = 0;
+  if (hex.size() > 2 && hex[0] == '0' && (hex[1] == 'x' || hex[1] == 'X'))
+    i = 2;
+  const size_t first = i;
   unsigned int res = 0;
-  std::stringstream ss;
-  ss << std::hex << hex;
-  ss >> res;
-  if (ss.fail()) {
-    throw std::invalid_argument("Invalid hexadecimal string: " + hex);
+  for (; i < hex.size(); ++i) {
+    const char c = hex[i];
+    unsigned int digit = 0;
+    if (c >= '0' && c <= '9')
+      digit = static_cast<unsigned int>(c - '0');
+    else if (c >= 'a' && c <= 'f')
+      digit = static_cast<unsigned int>(c - 'a' + 10);
+    else if (c >= 'A' && c <= 'F')
+      digit = static_cast<unsigned int>(c - 'A' + 10);
+    else
+      break;
+    if (res > (std::numeric_limits<unsigned int>::max() >> 4))
+      throw std::invalid_argument("Invalid hexadecimal string: " + hex);
+    res = (res << 4) | digit;
   }
+  if (i == first)
+    throw std::invalid_argument("Invalid hexadecimal string: " + hex);
   return res;
 }
 
+std::string joinPaths(const std::string &base, const std::string &relative) {
+  if (relative.empty())
+    return base;
+  std::string rel = relative;
+  if (!rel.empty() && rel[0] == '/')
+    rel.erase(0, 1);
+  if (base.empty())
+    return rel;
+  if (base[base.size() - 1] == '/')
+    return base + rel;
+  return base + "/" + rel;
+}
+
 std::string trimWhitespace(const std::string &value) {
   const std::string whitespace = " \t\n\r\f\v";
   if (value.empty()) {
@@ -47,6 +162,26 @@ std::string trimWhitespace(const std::string &value) {
   return value.substr(start, end - start + 1);
 }
 
+StringSpan trimWhitespace(const StringSpan &value) {
+  size_t start = 0;
+  size_t end = value.length;
+  while (start < end &&
+         std::isspace(static_cast<unsigned char>(value.data[start])))
+    ++start;
+  while (end > start &&
+         std::isspace(static_cast<unsigned char>(value.data[end - 1])))
+    --end;
+  return StringSpan(value.data + start, end - start);
+}
+
+StringSpan stripTrailingSemicolon(const StringSpan &token,
+                                  const char *context) {
+  if (token.empty() || token.back() != ';')
+    throw std::invalid_argument(std::string("Token is invalid in ") + context +
+                                " (missing semicolon)");
+  return StringSpan(token.data, token.length - 1);
+}
+
 void enforceTrailingSemicolon(std::string &token, const std::string &context) {
   if (token.empty() || token[token.size() - 1] != ';')
     throw std::invalid_argument("Token is invalid in " + context +
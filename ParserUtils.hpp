@@ -5,15 +5,48 @@
 #include <limits>
 #include <sstream>
 #include <stdexcept>
+#include <stdint.h>
 #include <string>
 
-static const unsigned long kDefaultMaxBodySize = 30000000UL; // 30 MB default
+static const uint64_t kDefaultMaxBodySize = 30000000UL; // 30 MB default
+
+// Non-owning view of characters that live elsewhere, usually the mapped
+// config file. Only values that end up stored get turned into strings.
+struct StringSpan {
+  const char *data;
+  size_t length;
+
+  StringSpan(void);
+  StringSpan(const char *str);
+  StringSpan(const std::string &str);
+  StringSpan(const char *str, size_t len);
+
+  bool empty(void) const;
+  char back(void) const;
+  bool operator==(const char *word) const;
+  bool operator!=(const char *word) const;
+  bool contains(const char *needle) const;
+  std::string str(void) const;
+};
 
 bool isAllDigits(const std::string &value);
+bool isAllDigits(const StringSpan &value);
+// Decimal digits only, no sign or blanks. Returns false instead of throwing
+// when the text is malformed or the value exceeds `limit`; never allocates.
+bool parseUnsigned(const StringSpan &text, uint64_t limit, uint64_t &value);
+// Like parseUnsigned, plus an optional k/m/g suffix (either case) that
+// scales by 1024, 1024^2 or 1024^3. The scaled value must fit in 64 bits.
+bool parseSize(const StringSpan &text, uint64_t &value);
 int stoiStrict(const std::string &str);
 unsigned int hexToUint(const std::string &hex);
 std::string statusCodeToString(short statusCode);
+// `relative` under `base`; one leading '/' of `relative` is dropped, so
+// "/errors/404.html" is looked up inside the root, like nginx does.
+std::string joinPaths(const std::string &base, const std::string &relative);
 std::string trimWhitespace(const std::string &value);
+StringSpan trimWhitespace(const StringSpan &value);
 void enforceTrailingSemicolon(std::string &token, const std::string &context);
+StringSpan stripTrailingSemicolon(const StringSpan &token,
+                                  const char *context);
 
 #endif
@@ -0,0 +1,188 @@
+#include "ProbeCache.hpp"
+
+namespace {
+__thread ProbeCache *t_active_cache = NULL;
+
+const int kUnknownType = -2;
+
+class LockGuard {
+private:
+  pthread_mutex_t &_mutex;
+
+  LockGuard(const LockGuard &other);
+  LockGuard &operator=(const LockGuard &other);
+
+public:
+  LockGuard(pthread_mutex_t &mutex) : _mutex(mutex) {
+    pthread_mutex_lock(&_mutex);
+  }
+  ~LockGuard() { pthread_mutex_unlock(&_mutex); }
+};
+} // namespace
+
+ProbeCache::ProbeCache(void)
+    : _entries(), _directories(), _hits(0), _misses(0) {
+  pthread_mutex_init(&_lock, NULL);
+}
+
+ProbeCache::ProbeCache(const ProbeCache &other)
+    : _entries(), _directories(), _hits(0), _misses(0) {
+  pthread_mutex_init(&_lock, NULL);
+  LockGuard guard(other._lock);
+  _entries = other._entries;
+  _directories = other._directories;
+  _hits = other._hits;
+  _misses = other._misses;
+}
+
+ProbeCache &ProbeCache::operator=(const ProbeCache &other) {
+  if (this != &other) {
+    std::map<Key, Entry> entries;
+    std::map<std::string, DirectoryHandle> directories;
+    size_t hits = 0;
+    size_t misses = 0;
+    {
+      LockGuard guard(other._lock);
+      entries = other._entries;
+      directories = other._directories;
+      hits = other._hits;
+      misses = other._misses;
+    }
+    LockGuard guard(_lock);
+    _entries.swap(entries);
+    _directories.swap(directories);
+    _hits = hits;
+    _misses = misses;
+  }
+  return (*this);
+}
+
+ProbeCache::~ProbeCache() { pthread_mutex_destroy(&_lock); }
+
+ProbeCache::Entry &ProbeCache::_lookup(const Key &key) {
+  std::map<Key, Entry>::iterator it = _entries.find(key);
+  if (it == _entries.end()) {
+    Entry entry;
+    entry.type = kUnknownType;
+    entry.known = 0;
+    entry.result = 0;
+    it = _entries.insert(std::make_pair(key, entry)).first;
+  }
+  return it->second;
+}
+
+// Probes below an open directory are keyed by its descriptor, which the
+// cache keeps open (see openDirectory) so it cannot be reused mid-parse.
+// Anything else is keyed by the path from the working directory.
+ProbeCache::Key ProbeCache::_key(const DirectoryHandle &directory,
+                                 const std::string &relative) {
+  if (directory.isOpen())
+    return Key(directory.getDescriptor(), relative);
+  if (directory.empty())
+    return Key(FileSystem::kWorkingDirectory, relative);
+  return Key(FileSystem::kWorkingDirectory, directory.join(relative));
+}
+
+int ProbeCache::getTypePath(const std::string &path) {
+  return getTypeAt(DirectoryHandle(), path);
+}
+
+int ProbeCache::checkFile(const std::string &path, int mode) {
+  return checkFileAt(DirectoryHandle(), path, mode);
+}
+
+// The syscall runs outside the lock so a batch of probes can overlap; two
+// threads racing on one unknown path both probe it and store the same answer.
+int ProbeCache::getTypeAt(const DirectoryHandle &directory,
+                          const std::string &relative) {
+  const Key key = _key(directory, relative);
+  {
+    LockGuard guard(_lock);
+    const Entry &entry = _lookup(key);
+    if (entry.type != kUnknownType) {
+      ++_hits;
+      return entry.type;
+    }
+    ++_misses;
+  }
+  const int type = directory.typeOf(relative);
+  LockGuard guard(_lock);
+  _lookup(key).type = type;
+  return type;
+}
+
+int ProbeCache::checkFileAt(const DirectoryHandle &directory,
+                            const std::string &relative, int mode) {
+  if (mode < 0 || mode > 7)
+    return directory.access(relative, mode);
+  const Key key = _key(directory, relative);
+  const unsigned char bit = static_cast<unsigned char>(1U << mode);
+  {
+    LockGuard guard(_lock);
+    const Entry &entry = _lookup(key);
+    if (entry.known & bit) {
+      ++_hits;
+      return (entry.result & bit) ? 0 : -1;
+    }
+    ++_misses;
+  }
+  const int result = directory.access(relative, mode);
+  LockGuard guard(_lock);
+  Entry &entry = _lookup(key);
+  entry.known |= bit;
+  if (result == 0)
+    entry.result |= bit;
+  else
+    entry.result &= static_cast<unsigned char>(~bit);
+  return result;
+}
+
+DirectoryHandle ProbeCache::openDirectory(const std::string &path) {
+  {
+    LockGuard guard(_lock);
+    std::map<std::string, DirectoryHandle>::const_iterator it =
+        _directories.find(path);
+    if (it != _directories.end())
+      return it->second;
+  }
+  const DirectoryHandle opened = DirectoryHandle::open(path);
+  LockGuard guard(_lock);
+  // A thread that lost the race drops its own handle for the stored one.
+  return _directories.insert(std::make_pair(path, opened)).first->second;
+}
+
+void ProbeCache::clear(void) {
+  LockGuard guard(_lock);
+  _entries.clear();
+  _directories.clear();
+  _hits = 0;
+  _misses = 0;
+}
+
+size_t ProbeCache::size(void) const {
+  LockGuard guard(_lock);
+  return _entries.size();
+}
+
+size_t ProbeCache::getHits(void) const {
+  LockGuard guard(_lock);
+  return _hits;
+}
+
+size_t ProbeCache::getMisses(void) const {
+  LockGuard guard(_lock);
+  return _misses;
+}
+
+ProbeCache *ProbeCache::active(void) { return t_active_cache; }
+
+ProbeCache *ProbeCache::activate(ProbeCache *cache) {
+  ProbeCache *previous = t_active_cache;
+  t_active_cache = cache;
+  return previous;
+}
+
+ProbeScope::ProbeScope(ProbeCache *cache)
+    : _previous(ProbeCache::activate(cache)) {}
+
+ProbeScope::~ProbeScope() { ProbeCache::activate(_previous); }
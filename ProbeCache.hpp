@@ -0,0 +1,74 @@
+#ifndef PROBECACHE_HPP
+#define PROBECACHE_HPP
+
+#include <map>
+#include <pthread.h>
+#include <string>
+
+#include "FileSystem.hpp"
+
+// Per-parse memo of filesystem probes. ConfigurationFile::getTypePath,
+// checkFile and their *At forms consult the cache activated on the calling
+// thread (see ProbeScope), so the many repeated stat()/access() calls
+// validation makes on the same roots, indexes and error pages hit the disk
+// once per path. It also keeps one DirectoryHandle per root for the parse.
+// Safe to share between the worker threads of one parse.
+class ProbeCache {
+private:
+  struct Entry {
+    int type;             // getTypePath() result
+    unsigned char known;  // bit m set once access(path, m) has been asked
+    unsigned char result; // bit m set when access(path, m) succeeded
+  };
+
+  // (directory handle or FileSystem::kWorkingDirectory, path below it)
+  typedef std::pair<int, std::string> Key;
+
+  std::map<Key, Entry> _entries;
+  std::map<std::string, DirectoryHandle> _directories;
+  size_t _hits;
+  size_t _misses;
+  mutable pthread_mutex_t _lock;
+
+  Entry &_lookup(const Key &key);
+  static Key _key(const DirectoryHandle &directory,
+                  const std::string &relative);
+
+public:
+  ProbeCache(void);
+  ProbeCache(const ProbeCache &other);
+  ProbeCache &operator=(const ProbeCache &other);
+  ~ProbeCache();
+
+  // Same contracts as ConfigurationFile::getTypePath and checkFile.
+  int getTypePath(const std::string &path);
+  int checkFile(const std::string &path, int mode);
+  int getTypeAt(const DirectoryHandle &directory, const std::string &relative);
+  int checkFileAt(const DirectoryHandle &directory,
+                  const std::string &relative, int mode);
+  // The same handle for every caller asking for `path` during the parse.
+  DirectoryHandle openDirectory(const std::string &path);
+  void clear(void);
+
+  size_t size(void) const;
+  size_t getHits(void) const;
+  size_t getMisses(void) const;
+
+  static ProbeCache *active(void);
+  static ProbeCache *activate(ProbeCache *cache);
+};
+
+// Makes `cache` the active probe cache of this thread for the scope.
+class ProbeScope {
+private:
+  ProbeCache *_previous;
+
+  ProbeScope(const ProbeScope &other);
+  ProbeScope &operator=(const ProbeScope &other);
+
+public:
+  ProbeScope(ProbeCache *cache);
+  ~ProbeScope();
+};
+
+#endif
@@ -1,31 +1,118 @@
 #include "ServerConfigParser.hpp"
 
+#include <algorithm>
 #include <arpa/inet.h>
-#include <cctype>
+#include <cerrno>
+#include <fcntl.h>
 #include <map>
+#include <sstream>
 #include <stdexcept>
+#include <unistd.h>
 
 #include "ConfigurationFile.hpp"
+#include "DirectiveTable.hpp"
+#include "FileSystem.hpp"
+#include "IncludeExpander.hpp"
+#include "ListenerIndex.hpp"
 #include "ParserUtils.hpp"
+#include "SharedConfig.hpp"
+#include "WorkerPool.hpp"
 
 namespace {
-std::vector<std::string> splitParameters(const std::string &line,
-                                         const std::string &delims) {
-  std::vector<std::string> tokens;
-  std::string::size_type start = 0;
-  while (start < line.size()) {
-    start = line.find_first_not_of(delims, start);
-    if (start == std::string::npos)
-      break;
-    std::string::size_type end = line.find_first_of(delims, start);
-    if (end == std::string::npos) {
-      tokens.push_back(line.substr(start));
+// Directives of one server block; locations and error pages are applied
+// once the whole block has been read, after root and index are known.
+struct ServerScope {
+  const ConfigLexer &tokens;
+  const TokenRange &block;
+  WebserverConfig &server;
+  std::vector<std::pair<StringSpan, TokenRange> > locations;
+  std::vector<TokenRange> error_pages;
+
+  ServerScope(const ConfigLexer &lexer, const TokenRange &range,
+              WebserverConfig &config)
+      : tokens(lexer), block(range), server(config), locations(),
+        error_pages() {}
+};
+
+struct ServerDirective {
+  const char *name;
+  void (*handler)(ServerScope &, size_t &, const ServerDirective &);
+  void (WebserverConfig::*setter)(const StringSpan &);
+  int duplicate_bit;
+  const char *duplicate_error;
+};
+
+void setServerValue(ServerScope &scope, size_t &index,
+                    const ServerDirective &directive) {
+  (scope.server.*directive.setter)(scope.tokens.text(++index));
+}
+
+void collectErrorPage(ServerScope &scope, size_t &index,
+                      const ServerDirective &) {
+  TokenRange error_codes;
+  error_codes.begin = index + 1;
+  while (++index < scope.block.end && scope.tokens.isWord(index)) {
+    if (scope.tokens.isTerminated(index))
       break;
-    }
-    tokens.push_back(line.substr(start, end - start));
-    start = end + 1;
   }
-  return tokens;
+  if (index >= scope.block.end || !scope.tokens.isWord(index))
+    throw std::runtime_error("Wrong character out of server scope{}");
+  error_codes.end = index + 1;
+  scope.error_pages.push_back(error_codes);
+}
+
+void collectLocation(ServerScope &scope, size_t &index,
+                     const ServerDirective &) {
+  ++index;
+  if (index >= scope.block.end || !scope.tokens.isWord(index))
+    throw std::runtime_error("Wrong character in server scope{}");
+  const StringSpan path = scope.tokens.text(index);
+
+  if ((index + 1) >= scope.block.end ||
+      scope.tokens.type(++index) != TOKEN_BLOCK_START)
+    throw std::runtime_error("Wrong character in server scope{}");
+  TokenRange location;
+  location.begin = index + 1;
+  location.end = scope.tokens.match(index);
+  if (location.end == std::string::npos || location.end >= scope.block.end)
+    throw std::runtime_error("Wrong character in server scope{}");
+  index = location.end;
+  scope.locations.push_back(std::make_pair(path, location));
+}
+
+enum ServerDirectiveBit {
+  SERVER_LISTEN,
+  SERVER_HOST,
+  SERVER_ROOT,
+  SERVER_MAX_BODY_SIZE,
+  SERVER_NAME,
+  SERVER_INDEX,
+  SERVER_AUTOINDEX
+};
+
+const ServerDirective kServerDirectives[] = {
+    {"listen", &setServerValue, &WebserverConfig::setPort, SERVER_LISTEN,
+     "Port is duplicated"},
+    {"host", &setServerValue, &WebserverConfig::setHost, SERVER_HOST,
+     "Host is duplicated"},
+    {"root", &setServerValue, &WebserverConfig::setRoot, SERVER_ROOT,
+     "Root is duplicated"},
+    {"client_max_body_size", &setServerValue,
+     &WebserverConfig::setClientMaxBodySize, SERVER_MAX_BODY_SIZE,
+     "Client_max_body_size is duplicated"},
+    {"server_name", &setServerValue, &WebserverConfig::setServerName,
+     SERVER_NAME, "Server_name is duplicated"},
+    {"index", &setServerValue, &WebserverConfig::setIndex, SERVER_INDEX,
+     "Index is duplicated"},
+    {"autoindex", &setServerValue, &WebserverConfig::setAutoindex,
+     SERVER_AUTOINDEX, "Autoindex of server is duplicated"},
+    {"error_page", &collectErrorPage, NULL, kRepeatable, NULL},
+    {"location", &collectLocation, NULL, kRepeatable, NULL},
+};
+
+const DirectiveTable<ServerDirective> &serverDirectives(void) {
+  static const DirectiveTable<ServerDirective> table(kServerDirectives);
+  return table;
 }
 
 std::string hostToString(const in_addr_t &host) {
@@ -36,198 +123,721 @@ std::string hostToString(const in_addr_t &host) {
     return "";
   return buffer;
 }
+
+// Shared between the pool's workers: each one parses blocks[i] into
+// servers[i] and leaves the message of a failed block in errors[i].
+struct ParallelParse {
+  ServerConfigParser *parser;
+  ParseArena *arena;
+  FileSystem *filesystem;
+  ProbeCache *probes;
+  StringInterner *interner;
+  std::vector<ValidationPlan> *plans;
+  const std::vector<TokenRange> *blocks;
+  const std::vector<size_t> *reuse; // npos: parse the block
+  std::vector<WebserverConfig> servers;
+  std::vector<std::string> errors;
+  std::vector<char> failed;
+};
+
+// Appends the file to a buffer one chunk at a time, from disk or from the
+// active in-memory FileSystem.
+class ChunkReader {
+private:
+  int _fd;
+  const std::string *_memory;
+  size_t _offset;
+
+  ChunkReader(const ChunkReader &other);
+  ChunkReader &operator=(const ChunkReader &other);
+
+public:
+  ChunkReader(const std::string &path)
+      : _fd(-1), _memory(FileSystem::current().contents(path)), _offset(0) {
+    if (_memory)
+      return;
+    _fd = open(path.c_str(), O_RDONLY);
+    if (_fd < 0)
+      throw std::runtime_error("Could not open file: " + path);
+  }
+
+  ~ChunkReader() {
+    if (_fd >= 0)
+      close(_fd);
+  }
+
+  // Returns the number of bytes appended, 0 at end of file.
+  size_t read(std::vector<char> &buffer, size_t chunk_size) {
+    if (_memory) {
+      const size_t got = std::min(chunk_size, _memory->size() - _offset);
+      buffer.insert(buffer.end(), _memory->begin() + _offset,
+                    _memory->begin() + _offset + got);
+      _offset += got;
+      return got;
+    }
+    const size_t used = buffer.size();
+    buffer.resize(used + chunk_size);
+    ssize_t got = -1;
+    do {
+      got = ::read(_fd, &buffer[used], chunk_size);
+    } while (got < 0 && errno == EINTR);
+    buffer.resize(used + (got > 0 ? static_cast<size_t>(got) : 0));
+    if (got < 0)
+      throw std::runtime_error("Could not read configuration file");
+    return static_cast<size_t>(got);
+  }
+};
+
+// Finds where top-level blocks end in a growing buffer, keeping brace depth
+// and comment state between calls so every byte is looked at once. Follows
+// the lexer's rules: '#' comments run to the newline and braces always
+// count, even inside words.
+struct BlockBoundary {
+  size_t scanned;
+  size_t depth;
+  bool in_comment;
+
+  BlockBoundary(void) : scanned(0), depth(0), in_comment(false) {}
+
+  // One past the '}' closing the next top-level block (a stray '}' also
+  // ends one, so splitServers can reject it), or npos if more input is
+  // needed.
+  size_t next(const std::vector<char> &buffer) {
+    while (scanned < buffer.size()) {
+      const char c = buffer[scanned++];
+      if (in_comment) {
+        in_comment = (c != '\n');
+      } else if (c == '#') {
+        in_comment = true;
+      } else if (c == '{') {
+        ++depth;
+      } else if (c == '}') {
+        if (depth <= 1) {
+          depth = 0;
+          return scanned;
+        }
+        --depth;
+      }
+    }
+    return std::string::npos;
+  }
+};
+
+// Servers are numbered from 1 in file order, as in print().
+std::string describeServer(size_t index, const std::string &name) {
+  std::ostringstream out;
+  out << "server #" << index + 1;
+  if (!name.empty())
+    out << " (" << name << ")";
+  return out.str();
+}
+
+std::string listenerClash(size_t first, const std::string &first_name,
+                          size_t second, const std::string &second_name,
+                          in_addr_t host, uint16_t port) {
+  return "Failed server validation: " + describeServer(first, first_name) +
+         " and " + describeServer(second, second_name) +
+         " both listen on " + ListenerIndex::describe(host, port);
+}
+
+// FNV-1a next to a multiply-xorshift mix, both fed every byte of every
+// token plus a separator that no byte value can fake.
+void digestTokens(const ConfigLexer &tokens, const TokenRange &block,
+                  uint64_t &first, uint64_t &second) {
+  first = 14695981039346656037ULL;
+  second = 0x9E3779B97F4A7C15ULL;
+  for (size_t i = block.begin; i < block.end; ++i) {
+    const StringSpan text = tokens.text(i);
+    for (size_t j = 0; j <= text.length; ++j) {
+      const uint64_t value =
+          j < text.length ? static_cast<unsigned char>(text.data[j])
+                          : 256 + static_cast<uint64_t>(tokens.type(i));
+      first = (first ^ value) * 1099511628211ULL;
+      second = (second + value) * 0xFF51AFD7ED558CCDULL;
+      second ^= second >> 29;
+    }
+  }
+}
+
+// What a lazy parse reads of a server block: its listen key and, for the
+// clash message, its name. Statements are walked the way the server scope
+// parses them, so a location path is never taken for a directive; the
+// first listen or host wins and repeats are left for the full parse.
+struct ListenKey {
+  in_addr_t host;
+  uint16_t port;
+  std::string name;
+
+  ListenKey(const ConfigLexer &tokens, const TokenRange &block)
+      : host(0), port(0), name() {
+    for (size_t i = block.begin; i < block.end; ++i) {
+      if (tokens.type(i) == TOKEN_BLOCK_START) {
+        i = tokens.match(i);
+        continue;
+      }
+      if (!tokens.isWord(i))
+        continue;
+      size_t last = i;
+      while (!tokens.isTerminated(last) && last + 1 < block.end &&
+             tokens.isWord(last + 1))
+        ++last;
+      if (last == i + 1 && tokens.isTerminated(last)) {
+        const StringSpan value = tokens.text(last);
+        if (!port && tokens.equals(i, "listen"))
+          port = WebserverConfig::parsePort(value);
+        else if (!host && tokens.equals(i, "host"))
+          host = WebserverConfig::parseHost(value);
+        else if (name.empty() && tokens.equals(i, "server_name"))
+          name.assign(value.data, value.length - 1);
+      }
+      i = last;
+    }
+    if (!host)
+      host = WebserverConfig::parseHost(StringSpan("localhost;"));
+    if (!port)
+      throw std::runtime_error("Port not found");
+  }
+};
 } // namespace
 
+bool ServerConfigParser::BlockDigest::operator<(
+    const BlockDigest &other) const {
+  if (first != other.first)
+    return (first < other.first);
+  return (second < other.second);
+}
+
 ServerConfigParser::ServerConfigParser(void)
-    : _servers(), _config_lines(), _num_of_servers(0) {}
+    : _arena(), _use_arena(false), _probes(), _interner(), _servers(),
+      _digests(),
+      _incremental(true), _reused(0), _previous(), _previous_digests(),
+      _digest_filesystem(NULL), _digest_cwd(),
+      _config_file(),
+      _expanded(), _fragments(), _sources(), _lexer(), _server_blocks(),
+      _num_of_servers(0), _threads(1),
+      _probe_threads(kDefaultProbeThreads),
+      _probe_pool(kDefaultProbeThreads), _plans(), _filesystem(NULL),
+      _lazy(false), _built(), _listeners() {}
 
+// The copy owns the source bytes its tokens point at (a lazy parse keeps them
+// in _expanded), so it never reads the file again.
+// Copies are plain heap objects; the arena is never shared.
 ServerConfigParser::ServerConfigParser(const ServerConfigParser &other)
-    : _servers(other._servers), _config_lines(other._config_lines),
-      _num_of_servers(other._num_of_servers) {}
+    : _arena(), _use_arena(other._use_arena), _probes(),
+      _interner(other._interner), _servers(other._servers),
+      _digests(other._digests),
+      _incremental(other._incremental), _reused(other._reused), _previous(),
+      _previous_digests(), _digest_filesystem(other._digest_filesystem),
+      _digest_cwd(other._digest_cwd), _config_file(other._config_file),
+      _expanded(other._expanded), _fragments(other._fragments),
+      _sources(other._sources), _lexer(other._lexer),
+      _server_blocks(other._server_blocks),
+      _num_of_servers(other._num_of_servers), _threads(other._threads),
+      _probe_threads(other._probe_threads), _probe_pool(other._probe_pool),
+      _plans(), _filesystem(other._filesystem), _lazy(other._lazy),
+      _built(other._built), _listeners(other._listeners) {
+  _lexer.rebase(_expanded.empty() ? _config_file.data() : &_expanded[0]);
+  // Servers built later must not move the ones already handed out.
+  if (!_built.empty())
+    _servers.reserve(_num_of_servers);
+}
 
 ServerConfigParser &
 ServerConfigParser::operator=(const ServerConfigParser &other) {
   if (this != &other) {
+    _reset();
+    _use_arena = other._use_arena;
+    _interner = other._interner;
     _servers = other._servers;
-    _config_lines = other._config_lines;
+    _digests = other._digests;
+    _digest_filesystem = other._digest_filesystem;
+    _digest_cwd = other._digest_cwd;
+    _incremental = other._incremental;
+    _reused = other._reused;
+    _config_file = other._config_file;
+    _expanded = other._expanded;
+    _fragments = other._fragments;
+    _sources = other._sources;
+    _lexer = other._lexer;
+    _lexer.rebase(_expanded.empty() ? _config_file.data() : &_expanded[0]);
+    _server_blocks = other._server_blocks;
     _num_of_servers = other._num_of_servers;
+    _threads = other._threads;
+    _probe_threads = other._probe_threads;
+    _probe_pool = other._probe_pool;
+    _filesystem = other._filesystem;
+    _lazy = other._lazy;
+    _built = other._built;
+    _listeners = other._listeners;
+    if (!_built.empty())
+      _servers.reserve(_num_of_servers);
   }
   return *this;
 }
 
 ServerConfigParser::~ServerConfigParser() {}
 
-int ServerConfigParser::createCluster(const std::string &config_path) {
-  _servers.clear();
-  _config_lines.clear();
+// Storage is swapped away rather than cleared: a cleared container keeps its
+// capacity, which may live in the arena released here.
+void ServerConfigParser::_reset(void) {
+  std::vector<WebserverConfig>().swap(_servers);
+  std::vector<BlockDigest>().swap(_digests);
+  std::vector<WebserverConfig>().swap(_previous);
+  std::vector<BlockDigest>().swap(_previous_digests);
+  _reused = 0;
+  _lexer.release();
+  std::vector<TokenRange>().swap(_server_blocks);
+  std::vector<char>().swap(_expanded);
+  std::vector<ConfigSource>().swap(_sources);
+  _config_file.unload();
   _num_of_servers = 0;
+  std::vector<ValidationPlan>().swap(_plans);
+  std::vector<size_t>().swap(_built);
+  _listeners.clear();
+  _probes.clear();
+  _interner.clear();
+  _arena.release();
+}
+
+int ServerConfigParser::createCluster(const std::string &config_path) {
+  std::vector<WebserverConfig> previous;
+  std::vector<BlockDigest> previous_digests;
+  if (_incremental && !_use_arena && !_arena.isReserved()) {
+    previous.swap(_servers);
+    previous_digests.swap(_digests);
+  }
+  _reset();
+  _previous.swap(previous);
+  _previous_digests.swap(previous_digests);
+  FileSystemScope filesystem(_filesystem ? _filesystem : FileSystem::active());
+  std::string cwd;
+  ConfigurationFile::getCurrentDirectory(cwd);
+  if (&FileSystem::current() != _digest_filesystem || cwd != _digest_cwd) {
+    std::vector<WebserverConfig>().swap(_previous);
+    std::vector<BlockDigest>().swap(_previous_digests);
+  }
+  _digest_filesystem = &FileSystem::current();
+  _digest_cwd.swap(cwd);
 
   if (ConfigurationFile::getTypePath(config_path) != 1)
     throw std::runtime_error("File is invalid");
   if (ConfigurationFile::checkFile(config_path, 4) == -1)
     throw std::runtime_error("File is not accessible");
 
-  ConfigurationFile file(config_path);
-  std::string content = file.getFileContent(config_path);
-  if (content.empty())
+  _config_file = ConfigurationFile(config_path);
+  _config_file.load();
+  if (!_config_file.getSize())
     throw std::runtime_error("File is empty");
+  ConfigSource source;
+  source.path = config_path;
+  source.stamp = _config_file.getStamp();
+  _sources.push_back(source);
 
-  removeComments(content);
-  removeWhitespaces(content);
-  splitServers(content);
-  if (_config_lines.size() != _num_of_servers)
+  if (!_use_arena || !_arena.reserve()) {
+    _buildCluster();
+    return 0;
+  }
+  try {
+    ArenaScope scope(&_arena);
+    _buildCluster();
+  } catch (const std::exception &e) {
+    // The exception (and its message) was allocated in the arena; the
+    // caller gets a heap copy that survives the next parse.
+    throw std::runtime_error(e.what());
+  }
+  return 0;
+}
+
+void ServerConfigParser::_buildCluster(void) {
+  ProbeScope probes(&_probes);
+  InternScope interned(&_interner);
+  _lexer.tokenize(_config_file.data(), _config_file.getSize());
+  if (IncludeExpander::hasIncludes(_lexer))
+    _expandIncludes();
+  splitServers();
+  if (_server_blocks.size() != _num_of_servers)
     throw std::runtime_error("Server count mismatch after parsing");
 
-  for (size_t i = 0; i < _num_of_servers; ++i) {
-    WebserverConfig server;
-    createServer(_config_lines[i], server);
-    _servers.push_back(server);
+  if (_lazy) {
+    std::vector<WebserverConfig>().swap(_previous);
+    std::vector<BlockDigest>().swap(_previous_digests);
+    _ownSource();
+    _indexServers();
+    return;
   }
-
-  if (_num_of_servers > 1)
+  std::vector<size_t> reuse;
+  std::vector<BlockDigest> digests;
+  _matchPrevious(reuse, digests);
+  try {
+    _createServers(reuse);
     checkServers();
-  return 0;
+  } catch (...) {
+    // Half-built servers must not be taken over by a retry as if they had
+    // been validated.
+    std::vector<WebserverConfig>().swap(_servers);
+    _listeners.clear();
+    _num_of_servers = 0;
+    throw;
+  }
+  // Only a cluster that passed every check is offered to the next parse.
+  _digests.swap(digests);
+  _releaseSource();
+}
+
+// Lazy servers are built from the tokens long after createCluster, so the
+// tokens move into bytes the parser owns: an edit to the file, or a copy of
+// the parser, cannot change the text under them.
+void ServerConfigParser::_ownSource(void) {
+  if (_expanded.empty()) {
+    _expanded.assign(_config_file.data(),
+                     _config_file.data() + _config_file.getSize());
+    _lexer.rebase(&_expanded[0]);
+  }
+  _config_file.unload();
+}
+
+// A full parse needs its tokens no longer; nothing keeps the mapping.
+void ServerConfigParser::_releaseSource(void) {
+  _lexer.release();
+  std::vector<TokenRange>().swap(_server_blocks);
+  std::vector<char>().swap(_expanded);
+  _config_file.unload();
+}
+
+// Builds the servers of every block whose reuse entry is npos (all of them
+// when `reuse` is empty) and takes the others over from _previous.
+void ServerConfigParser::_createServers(const std::vector<size_t> &reuse) {
+  size_t pending = _num_of_servers;
+  for (size_t i = 0; i < reuse.size(); ++i) {
+    if (reuse[i] != std::string::npos)
+      --pending;
+  }
+  _plans.resize(_num_of_servers);
+  if (_threads != 1 && pending > 1) {
+    _createServersParallel(reuse);
+  } else {
+    // Built in place: one default server copied into each slot is far
+    // cheaper than copying every finished server (and its locations).
+    _servers.resize(_num_of_servers);
+    for (size_t i = 0; i < _num_of_servers; ++i) {
+      if (!reuse.empty() && reuse[i] != std::string::npos)
+        continue;
+      PlanScope plan(&_plans[i]);
+      createServer(_server_blocks[i], _servers[i]);
+    }
+  }
+  // Validated first, so a failure leaves _previous as it was.
+  validatePlans(_plans, _probe_pool);
+  for (size_t i = 0; i < reuse.size(); ++i) {
+    if (reuse[i] != std::string::npos)
+      _servers[i].swap(_previous[reuse[i]]);
+  }
+  std::vector<WebserverConfig>().swap(_previous);
+  std::vector<BlockDigest>().swap(_previous_digests);
 }
 
-void ServerConfigParser::removeComments(std::string &content) {
-  size_t pos = content.find('#');
-  while (pos != std::string::npos) {
-    size_t end = content.find('\n', pos);
-    if (end == std::string::npos) {
-      content.erase(pos);
+// The lazy parse: listen keys only. _servers gets room for every server
+// now so that building one later never moves another.
+void ServerConfigParser::_indexServers(void) {
+  _built.assign(_num_of_servers, std::string::npos);
+  _servers.reserve(_num_of_servers);
+  _listeners.reserve(_num_of_servers);
+  for (size_t i = 0; i < _num_of_servers; ++i) {
+    const ListenKey key(_lexer, _server_blocks[i]);
+    const size_t clash = _listeners.claim(key.host, key.port, i);
+    if (clash != ListenerIndex::npos)
+      throw std::runtime_error(listenerClash(
+          clash, ListenKey(_lexer, _server_blocks[clash]).name, i, key.name,
+          key.host, key.port));
+  }
+}
+
+WebserverConfig &ServerConfigParser::_materialize(size_t index) {
+  if (_built[index] == std::string::npos) {
+    if (!_arena.isReserved()) {
+      _buildServer(index);
     } else {
-      content.erase(pos, end - pos);
+      try {
+        ArenaScope scope(&_arena);
+        _buildServer(index);
+      } catch (const std::exception &e) {
+        throw std::runtime_error(e.what());
+      }
     }
-    pos = content.find('#');
   }
+  return _servers[_built[index]];
 }
 
-void ServerConfigParser::removeWhitespaces(std::string &content) {
-  content = trimWhitespace(content);
+// One server of a lazy parse, parsed and validated on its own; it only
+// joins _servers once it is valid.
+void ServerConfigParser::_buildServer(size_t index) {
+  FileSystemScope filesystem(_filesystem ? _filesystem : FileSystem::active());
+  ProbeScope probes(&_probes);
+  InternScope interned(&_interner);
+  std::vector<ValidationPlan> plans(1);
+  _servers.resize(_servers.size() + 1);
+  try {
+    PlanScope plan(&plans[0]);
+    createServer(_server_blocks[index], _servers.back());
+    validatePlans(plans, _probe_pool);
+  } catch (...) {
+    _servers.pop_back();
+    throw;
+  }
+  _built[index] = _servers.size() - 1;
 }
 
-void ServerConfigParser::splitServers(std::string &content) {
-  if (content.find("server") == std::string::npos)
-    throw std::runtime_error("Server did not find");
+void ServerConfigParser::materializeServers(void) {
+  if (_built.empty())
+    return;
+  if (!_arena.isReserved()) {
+    _materializeRest();
+    return;
+  }
+  try {
+    ArenaScope scope(&_arena);
+    _materializeRest();
+  } catch (const std::exception &e) {
+    throw std::runtime_error(e.what());
+  }
+}
 
-  size_t search_pos = 0;
-  while (search_pos < content.size()) {
-    size_t start = locateServerStart(content, search_pos);
-    if (start == std::string::npos)
-      break;
-    size_t end = locateServerEnd(content, start);
-    if (end == std::string::npos)
-      throw std::runtime_error("Problem with scope");
-    _config_lines.push_back(content.substr(start, end - start + 1));
-    ++_num_of_servers;
-    search_pos = end + 1;
+// The servers built so far are taken over like the unchanged ones of an
+// incremental parse; on failure they are put back where they were.
+void ServerConfigParser::_materializeRest(void) {
+  FileSystemScope filesystem(_filesystem ? _filesystem : FileSystem::active());
+  ProbeScope probes(&_probes);
+  InternScope interned(&_interner);
+  std::vector<size_t> reuse;
+  reuse.swap(_built);
+  _previous.swap(_servers);
+  try {
+    _createServers(reuse);
+  } catch (...) {
+    std::vector<ValidationPlan>().swap(_plans);
+    _servers.swap(_previous);
+    std::vector<WebserverConfig>().swap(_previous);
+    reuse.swap(_built);
+    throw;
   }
+  std::vector<ValidationPlan>().swap(_plans);
 }
 
-size_t ServerConfigParser::locateServerStart(std::string &content, size_t pos) {
-  size_t keyword_pos = content.find("server", pos);
-  if (keyword_pos == std::string::npos) {
-    for (size_t i = pos; i < content.size(); ++i) {
-      if (!std::isspace(static_cast<unsigned char>(content[i])))
-        throw std::runtime_error("Wrong character out of server scope{}");
-    }
-    return std::string::npos;
+// Digests every block into `digests` and, when the previous parse left
+// servers behind, pairs each block with an unclaimed previous server of the
+// same digest.
+void ServerConfigParser::_matchPrevious(std::vector<size_t> &reuse,
+                                        std::vector<BlockDigest> &digests) {
+  if (!_incremental || _arena.isReserved())
+    return;
+  digests.resize(_num_of_servers);
+  for (size_t i = 0; i < _num_of_servers; ++i)
+    digestTokens(_lexer, _server_blocks[i], digests[i].first,
+                 digests[i].second);
+  if (_previous.empty())
+    return;
+  std::multimap<BlockDigest, size_t> previous;
+  for (size_t i = 0; i < _previous_digests.size(); ++i)
+    previous.insert(std::make_pair(_previous_digests[i], i));
+  reuse.assign(_num_of_servers, std::string::npos);
+  for (size_t i = 0; i < _num_of_servers; ++i) {
+    std::multimap<BlockDigest, size_t>::iterator it =
+        previous.find(digests[i]);
+    if (it == previous.end())
+      continue;
+    reuse[i] = it->second;
+    previous.erase(it);
+    ++_reused;
   }
-  for (size_t i = pos; i < keyword_pos; ++i) {
-    if (!std::isspace(static_cast<unsigned char>(content[i])))
-      throw std::runtime_error("Wrong character out of server scope{}");
+}
+
+void ServerConfigParser::_expandIncludes(void) {
+  IncludeExpander includes(_fragments, _probe_threads);
+  ConfigLexer expanded;
+  includes.expand(_config_file.getFilename(), _config_file.data(),
+                  _config_file.getSize(), _lexer, _expanded, expanded);
+  _lexer = expanded;
+  _lexer.rebase(_expanded.empty() ? "" : &_expanded[0]);
+  ArenaScope heap(NULL);
+  const std::vector<std::string> &files = includes.getFiles();
+  for (size_t i = 0; i < files.size(); ++i) {
+    ConfigSource source;
+    source.path = files[i];
+    source.stamp = _fragments.find(files[i])->stamp;
+    _sources.push_back(source);
   }
-  size_t brace_pos = keyword_pos + 6;
-  while (brace_pos < content.size() &&
-         std::isspace(static_cast<unsigned char>(content[brace_pos])))
-    ++brace_pos;
-  if (brace_pos >= content.size() || content[brace_pos] != '{')
-    throw std::runtime_error("Wrong character out of server scope{}");
-  return brace_pos;
 }
 
-size_t ServerConfigParser::locateServerEnd(std::string &content, size_t pos) {
-  if (pos == std::string::npos || pos >= content.size() || content[pos] != '{')
-    return std::string::npos;
-  size_t scope = 0;
-  for (size_t i = pos + 1; i < content.size(); ++i) {
-    if (content[i] == '{') {
-      ++scope;
-    } else if (content[i] == '}') {
-      if (scope == 0)
-        return i;
-      --scope;
+size_t ServerConfigParser::streamCluster(const std::string &config_path,
+                                         ServerCallback callback,
+                                         void *context, size_t chunk_size) {
+  _reset();
+  FileSystemScope filesystem(_filesystem ? _filesystem : FileSystem::active());
+
+  if (ConfigurationFile::getTypePath(config_path) != 1)
+    throw std::runtime_error("File is invalid");
+  if (ConfigurationFile::checkFile(config_path, 4) == -1)
+    throw std::runtime_error("File is not accessible");
+  if (!chunk_size)
+    chunk_size = kStreamChunkSize;
+
+  ProbeScope probes(&_probes);
+  InternScope interned(&_interner);
+  ChunkReader reader(config_path);
+  BlockBoundary boundary;
+  std::vector<char> buffer;
+  // checkServers needs the whole cluster; only the listen pairs and the
+  // names for the error are kept here.
+  ListenerIndex listens;
+  std::vector<std::string> names;
+  size_t delivered = 0;
+  bool empty = true;
+  for (;;) {
+    const size_t got = reader.read(buffer, chunk_size);
+    if (got)
+      empty = false;
+    size_t start = 0;
+    size_t end = 0;
+    while ((end = boundary.next(buffer)) != std::string::npos) {
+      WebserverConfig server;
+      _streamBlock(&buffer[start], end - start, server);
+      validatePlans(_plans, _probe_pool);
+      const size_t clash =
+          listens.claim(server.getHost(), server.getPort(), delivered);
+      if (clash != ListenerIndex::npos)
+        throw std::runtime_error(listenerClash(
+            clash, names[clash], delivered, server.getServerName(),
+            server.getHost(), server.getPort()));
+      names.push_back(server.getServerName());
+      if (callback)
+        callback(server, context);
+      ++delivered;
+      start = end;
+    }
+    if (start) {
+      buffer.erase(buffer.begin(), buffer.begin() + start);
+      boundary.scanned -= start;
     }
+    if (!got)
+      break;
+  }
+  if (empty)
+    throw std::runtime_error("File is empty");
+
+  // The tail holds no complete block: blanks and comments are fine, anything
+  // else is rejected the way splitServers rejects it in createCluster.
+  _lexer.tokenize(buffer.empty() ? "" : &buffer[0], buffer.size());
+  if (!_lexer.empty() || !delivered) {
+    splitServers();
+    throw std::runtime_error("Problem with scope");
   }
-  return std::string::npos;
+  _lexer.clear();
+  return delivered;
 }
 
-void ServerConfigParser::createServer(std::string &server_config,
+void ServerConfigParser::_streamBlock(const char *data, size_t size,
                                       WebserverConfig &server) {
-  _parseServerContent(server_config, server);
+  _lexer.tokenize(data, size);
+  _server_blocks.clear();
+  _num_of_servers = 0;
+  splitServers();
+  _plans.resize(1);
+  _plans[0].clear();
+  PlanScope plan(&_plans[0]);
+  createServer(_server_blocks[0], server);
+  _server_blocks.clear();
+  _num_of_servers = 0;
 }
 
-void ServerConfigParser::_parseServerContent(const std::string &config,
+void ServerConfigParser::splitServers(void) {
+  if (_lexer.empty())
+    throw std::runtime_error("Server did not find");
+
+  size_t i = 0;
+  while (i < _lexer.size()) {
+    if (!_lexer.equals(i, "server") || i + 1 >= _lexer.size() ||
+        _lexer.type(i + 1) != TOKEN_BLOCK_START)
+      throw std::runtime_error("Wrong character out of server scope{}");
+    size_t end = _lexer.match(i + 1);
+    if (end == std::string::npos)
+      throw std::runtime_error("Problem with scope");
+    TokenRange block;
+    block.begin = i + 2;
+    block.end = end;
+    _server_blocks.push_back(block);
+    ++_num_of_servers;
+    i = end + 1;
+  }
+}
+
+void ServerConfigParser::createServer(const TokenRange &block,
+                                      WebserverConfig &server) {
+  _parseServerContent(block, server);
+}
+
+// Blocks are independent until checkServers, so they are parsed on the pool
+// into pre-sized slots. Every block runs to completion and the first failure
+// in file order is rethrown, which is the error the serial loop would raise.
+void ServerConfigParser::_createServersParallel(
+    const std::vector<size_t> &reuse) {
+  ParallelParse job;
+  job.parser = this;
+  job.arena = ParseArena::active();
+  job.filesystem = FileSystem::active();
+  job.probes = ProbeCache::active();
+  job.interner = StringInterner::active();
+  job.plans = &_plans;
+  job.blocks = &_server_blocks;
+  job.reuse = reuse.empty() ? NULL : &reuse;
+  job.servers.resize(_num_of_servers);
+  job.errors.resize(_num_of_servers);
+  job.failed.resize(_num_of_servers, 0);
+
+  WorkerPool(_threads).run(_num_of_servers, &_createServerTask, &job);
+  for (size_t i = 0; i < _num_of_servers; ++i) {
+    if (job.failed[i])
+      throw std::runtime_error(job.errors[i]);
+  }
+  _servers.swap(job.servers);
+}
+
+void ServerConfigParser::_createServerTask(size_t index, void *context) {
+  ParallelParse &job = *static_cast<ParallelParse *>(context);
+  ArenaScope arena(job.arena);
+  FileSystemScope filesystem(job.filesystem);
+  ProbeScope probes(job.probes);
+  InternScope interned(job.interner);
+  if (job.reuse && (*job.reuse)[index] != std::string::npos)
+    return;
+  PlanScope plan(&(*job.plans)[index]);
+  try {
+    job.parser->createServer((*job.blocks)[index], job.servers[index]);
+  } catch (const std::exception &e) {
+    job.errors[index] = e.what();
+    job.failed[index] = 1;
+  }
+}
+
+void ServerConfigParser::_parseServerContent(const TokenRange &block,
                                              WebserverConfig &server) {
-  std::vector<std::string> tokens =
-      splitParameters(config + ' ', std::string(" \n\t\r"));
-  if (tokens.size() < 3)
+  if (block.begin >= block.end)
     throw std::runtime_error("Failed server validation");
 
-  bool flag_autoindex = false;
-  bool flag_max_body_size = false;
-  std::vector<std::pair<std::string, std::vector<std::string> > > locations;
-  std::vector<std::vector<std::string> > error_page_blocks;
-
-  for (size_t i = 0; i < tokens.size(); ++i) {
-    if (tokens[i] == "listen" && (i + 1) < tokens.size()) {
-      if (server.getPort())
-        throw std::runtime_error("Port is duplicated");
-      server.setPort(tokens[++i]);
-    } else if (tokens[i] == "location" && (i + 1) < tokens.size()) {
-      std::string path;
-      std::vector<std::string> location_tokens;
-      _collectLocationBlock(tokens, i, path, location_tokens);
-      locations.push_back(std::make_pair(path, location_tokens));
-    } else if (tokens[i] == "host" && (i + 1) < tokens.size()) {
-      if (server.getHost())
-        throw std::runtime_error("Host is duplicated");
-      server.setHost(tokens[++i]);
-    } else if (tokens[i] == "root" && (i + 1) < tokens.size()) {
-      if (!server.getRoot().empty())
-        throw std::runtime_error("Root is duplicated");
-      server.setRoot(tokens[++i]);
-    } else if (tokens[i] == "error_page" && (i + 1) < tokens.size()) {
-      std::vector<std::string> error_codes;
-      while (++i < tokens.size()) {
-        error_codes.push_back(tokens[i]);
-        if (tokens[i].find(';') != std::string::npos)
-          break;
-        if (i + 1 >= tokens.size())
-          throw std::runtime_error("Wrong character out of server scope{}");
-      }
-      error_page_blocks.push_back(error_codes);
-    } else if (tokens[i] == "client_max_body_size" && (i + 1) < tokens.size()) {
-      if (flag_max_body_size)
-        throw std::runtime_error("Client_max_body_size is duplicated");
-      server.setClientMaxBodySize(tokens[++i]);
-      flag_max_body_size = true;
-    } else if (tokens[i] == "server_name" && (i + 1) < tokens.size()) {
-      if (!server.getServerName().empty())
-        throw std::runtime_error("Server_name is duplicated");
-      server.setServerName(tokens[++i]);
-    } else if (tokens[i] == "index" && (i + 1) < tokens.size()) {
-      if (!server.getIndex().empty())
-        throw std::runtime_error("Index is duplicated");
-      server.setIndex(tokens[++i]);
-    } else if (tokens[i] == "autoindex" && (i + 1) < tokens.size()) {
-      if (flag_autoindex)
-        throw std::runtime_error("Autoindex of server is duplicated");
-      server.setAutoindex(tokens[++i]);
-      flag_autoindex = true;
-    } else if (tokens[i] != "}" && tokens[i] != "{") {
-      throw std::runtime_error("Unsupported directive: " + tokens[i]);
-    }
+  const DirectiveTable<ServerDirective> &directives = serverDirectives();
+  ServerScope scope(_lexer, block, server);
+  unsigned long seen = 0;
+
+  for (size_t i = block.begin; i < block.end; ++i) {
+    if (!_lexer.isWord(i))
+      continue;
+    const ServerDirective *directive = NULL;
+    if ((i + 1) < block.end)
+      directive = directives.find(_lexer.text(i));
+    if (!directive)
+      throw std::runtime_error("Unsupported directive: " +
+                               _lexer.text(i).str());
+    DirectiveTable<ServerDirective>::claim(*directive, seen);
+    directive->handler(scope, i, *directive);
   }
 
   if (server.getRoot().empty())
@@ -237,16 +847,19 @@ void ServerConfigParser::_parseServerContent(const std::string &config,
   if (server.getIndex().empty())
     server.setIndex("index.html;");
 
-  for (size_t i = 0; i < error_page_blocks.size(); ++i)
-    server.setErrorPages(error_page_blocks[i]);
-  for (size_t i = 0; i < locations.size(); ++i)
-    _parseLocationTokens(locations[i].first, locations[i].second, server);
+  for (size_t i = 0; i < scope.error_pages.size(); ++i)
+    server.setErrorPages(_lexer, scope.error_pages[i]);
+  server.reserveLocationBlocks(scope.locations.size());
+  for (size_t i = 0; i < scope.locations.size(); ++i)
+    _parseLocationTokens(scope.locations[i].first.str(),
+                         scope.locations[i].second, server);
 
-  if (ConfigurationFile::doesFileExistAndIsReadable(server.getRoot(),
-                                                    server.getIndex()))
-    throw std::runtime_error("Index from config file not found or unreadable");
-  if (server.checkLocations())
-    throw std::runtime_error("Locaition is duplicated");
+  std::string error;
+  if (!requirePath(readableFileCheck(
+                       server.getRootDirectory(), server.getIndex(),
+                       "Index from config file not found or unreadable"),
+                   error))
+    throw std::runtime_error(error);
   if (!server.getPort())
     throw std::runtime_error("Port not found");
   if (!server.isValidErrorPages())
@@ -254,45 +867,131 @@ void ServerConfigParser::_parseServerContent(const std::string &config,
         "Incorrect path for error page or number of error");
 }
 
-void ServerConfigParser::_collectLocationBlock(
-    const std::vector<std::string> &tokens, size_t &index, std::string &path,
-    std::vector<std::string> &location_tokens) {
-  ++index;
-  if (index >= tokens.size() || tokens[index] == "{" || tokens[index] == "}")
-    throw std::runtime_error("Wrong character in server scope{}");
-  path = tokens[index];
-
-  if ((index + 1) >= tokens.size() || tokens[++index] != "{")
-    throw std::runtime_error("Wrong character in server scope{}");
-  ++index;
-
-  while (index < tokens.size() && tokens[index] != "}")
-    location_tokens.push_back(tokens[index++]);
+void ServerConfigParser::_parseLocationTokens(const std::string &path,
+                                              const TokenRange &location,
+                                              WebserverConfig &server) {
+  server.setLocationBlocks(path, _lexer, location);
+}
 
-  if (index >= tokens.size() || tokens[index] != "}")
-    throw std::runtime_error("Wrong character in server scope{}");
+// Leaves the listen keys in _listeners for findServer.
+void ServerConfigParser::checkServers(void) {
+  _listeners.clear();
+  _claimListeners(_servers, _listeners);
 }
 
-void ServerConfigParser::_parseLocationTokens(
-    const std::string &path, const std::vector<std::string> &location_tokens,
-    WebserverConfig &server) {
-  server.setLocationBlocks(path, location_tokens);
+void ServerConfigParser::checkServers(
+    const std::vector<WebserverConfig> &servers) {
+  ListenerIndex listens;
+  _claimListeners(servers, listens);
 }
 
-void ServerConfigParser::checkServers(void) {
-  for (size_t i = 0; i < _servers.size(); ++i) {
-    for (size_t j = i + 1; j < _servers.size(); ++j) {
-      if (_servers[i].getPort() == _servers[j].getPort() &&
-          _servers[i].getHost() == _servers[j].getHost())
-        throw std::runtime_error("Failed server validation");
-    }
+void ServerConfigParser::_claimListeners(
+    const std::vector<WebserverConfig> &servers, ListenerIndex &listens) {
+  listens.reserve(servers.size());
+  for (size_t i = 0; i < servers.size(); ++i) {
+    const size_t clash =
+        listens.claim(servers[i].getHost(), servers[i].getPort(), i);
+    if (clash != ListenerIndex::npos)
+      throw std::runtime_error(listenerClash(
+          clash, servers[clash].getServerName(), i,
+          servers[i].getServerName(), servers[i].getHost(),
+          servers[i].getPort()));
   }
 }
 
-std::vector<WebserverConfig> ServerConfigParser::getServers() const {
+const std::vector<WebserverConfig> &ServerConfigParser::getServers() const {
   return _servers;
 }
 
+size_t ServerConfigParser::getServerCount(void) const {
+  return _num_of_servers;
+}
+
+const WebserverConfig &ServerConfigParser::getServer(size_t index) {
+  if (index >= _num_of_servers)
+    throw std::runtime_error("Server index out of range");
+  if (_built.empty())
+    return _servers[index];
+  return _materialize(index);
+}
+
+const WebserverConfig *ServerConfigParser::findServer(in_addr_t host,
+                                                      uint16_t port) {
+  const size_t index = _listeners.find(host, port);
+  if (index == ListenerIndex::npos)
+    return NULL;
+  return &getServer(index);
+}
+
+void ServerConfigParser::releaseServers(std::vector<WebserverConfig> &servers) {
+  materializeServers();
+  if (_arena.isReserved())
+    std::vector<WebserverConfig>(_servers).swap(servers);
+  else
+    servers.swap(_servers);
+  _reset();
+}
+
+void ServerConfigParser::publishServers(SharedConfig &shared) {
+  materializeServers();
+  shared.publish(_servers, _sources);
+}
+
+void ServerConfigParser::setThreads(size_t threads) { _threads = threads; }
+
+size_t ServerConfigParser::getThreads(void) const { return _threads; }
+
+void ServerConfigParser::setProbeThreads(size_t threads) {
+  _probe_threads = threads;
+  _probe_pool = WorkerPool(threads);
+}
+
+size_t ServerConfigParser::getProbeThreads(void) const {
+  return _probe_threads;
+}
+
+void ServerConfigParser::setUseArena(bool enabled) { _use_arena = enabled; }
+
+void ServerConfigParser::setIncremental(bool enabled) {
+  _incremental = enabled;
+}
+
+bool ServerConfigParser::getIncremental(void) const { return _incremental; }
+
+size_t ServerConfigParser::getReusedServers(void) const { return _reused; }
+
+void ServerConfigParser::setLazy(bool enabled) { _lazy = enabled; }
+
+bool ServerConfigParser::getLazy(void) const { return _lazy; }
+
+bool ServerConfigParser::getUseArena(void) const { return _use_arena; }
+
+const ParseArena &ServerConfigParser::getArena(void) const { return _arena; }
+
+void ServerConfigParser::setFileSystem(FileSystem *filesystem) {
+  _filesystem = filesystem;
+}
+
+FileSystem *ServerConfigParser::getFileSystem(void) const {
+  return _filesystem;
+}
+
+const ProbeCache &ServerConfigParser::getProbeCache(void) const {
+  return _probes;
+}
+
+const StringInterner &ServerConfigParser::getInterner(void) const {
+  return _interner;
+}
+
+const FragmentCache &ServerConfigParser::getFragmentCache(void) const {
+  return _fragments;
+}
+
+const std::vector<ConfigSource> &ServerConfigParser::getSources(void) const {
+  return _sources;
+}
+
 int ServerConfigParser::print(std::ostream &out) const {
   out << "------------- Config -------------" << std::endl;
   for (size_t i = 0; i < _servers.size(); ++i) {
@@ -305,10 +1004,10 @@ int ServerConfigParser::print(std::ostream &out) const {
     out << "Port: " << server.getPort() << std::endl;
     out << "Max BSize: " << server.getMaxBodySize() << std::endl;
     out << "Error pages: " << server.getErrorPages().size() << std::endl;
-    std::map<short, std::string>::const_iterator error_it =
+    std::map<short, InternedString>::const_iterator error_it =
         server.getErrorPages().begin();
     while (error_it != server.getErrorPages().end()) {
-      out << error_it->first << " - " << error_it->second << std::endl;
+      out << error_it->first << " - " << error_it->second.str() << std::endl;
       ++error_it;
     }
     out << "Locations: " << server.getLocationBlocks().size() << std::endl;
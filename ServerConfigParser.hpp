@@ -4,21 +4,96 @@
 #include <string>
 #include <vector>
 
+#include "ConfigLexer.hpp"
+#include "ConfigurationFile.hpp"
+#include "FileSystem.hpp"
+#include "FragmentCache.hpp"
+#include "ListenerIndex.hpp"
+#include "ParseArena.hpp"
+#include "ProbeCache.hpp"
+#include "StringInterner.hpp"
+#include "ValidationPlan.hpp"
 #include "WebserverConfig.hpp"
 
+class SharedConfig;
+
+// Receives each server of a streamed parse as soon as it is complete. The
+// reference is only valid for the duration of the call.
+typedef void (*ServerCallback)(const WebserverConfig &server, void *context);
+
 class ServerConfigParser {
 private:
+  // Two independent 64-bit hashes of a server block's tokens; blocks with
+  // equal digests are taken to be the same text.
+  struct BlockDigest {
+    uint64_t first;
+    uint64_t second;
+
+    bool operator<(const BlockDigest &other) const;
+  };
+
+  // Declared first so it is torn down after everything it may back.
+  ParseArena _arena;
+  bool _use_arena;
+  ProbeCache _probes;
+  // Roots and indexes of the current parse; the servers keep their values.
+  StringInterner _interner;
   std::vector<WebserverConfig> _servers;
-  std::vector<std::string> _config_lines;
+  std::vector<BlockDigest> _digests; // one per server in _servers
+  bool _incremental;
+  size_t _reused;
+  // The previous parse's servers, during a parse that may take them over.
+  std::vector<WebserverConfig> _previous;
+  std::vector<BlockDigest> _previous_digests;
+  // Backend and working directory the last parse probed through; a block
+  // is only taken over when both are unchanged, since the same relative
+  // path may name another file under either.
+  const FileSystem *_digest_filesystem;
+  std::string _digest_cwd;
+  ConfigurationFile _config_file;
+  // Text of the configuration with its includes spliced in; empty when it
+  // has none and the tokens point into _config_file.
+  std::vector<char> _expanded;
+  FragmentCache _fragments;
+  // The configuration file and every file it included, on the heap.
+  std::vector<ConfigSource> _sources;
+  ConfigLexer _lexer;
+  std::vector<TokenRange> _server_blocks;
   size_t _num_of_servers;
+  size_t _threads;
+  size_t _probe_threads;
+  // Probes validatePlans hands out, on threads kept for the parser's life.
+  WorkerPool _probe_pool;
+  std::vector<ValidationPlan> _plans;
+  FileSystem *_filesystem;
+  bool _lazy;
+  // After a lazy parse: where each block's server sits in _servers, npos
+  // until it is built. Empty once every server is (materializeServers).
+  std::vector<size_t> _built;
+  // (host, port) -> block, for findServer.
+  ListenerIndex _listeners;
 
-  void _parseServerContent(const std::string &config, WebserverConfig &server);
-  void _collectLocationBlock(const std::vector<std::string> &tokens,
-                             size_t &index, std::string &path,
-                             std::vector<std::string> &location_tokens);
+  void _parseServerContent(const TokenRange &block, WebserverConfig &server);
   void _parseLocationTokens(const std::string &path,
-                            const std::vector<std::string> &location_tokens,
+                            const TokenRange &location,
                             WebserverConfig &server);
+  void _reset(void);
+  void _buildCluster(void);
+  void _ownSource(void);
+  void _releaseSource(void);
+  void _expandIncludes(void);
+  void _matchPrevious(std::vector<size_t> &reuse,
+                      std::vector<BlockDigest> &digests);
+  void _createServers(const std::vector<size_t> &reuse);
+  void _createServersParallel(const std::vector<size_t> &reuse);
+  void _indexServers(void);
+  WebserverConfig &_materialize(size_t index);
+  void _buildServer(size_t index);
+  void _materializeRest(void);
+  static void _claimListeners(const std::vector<WebserverConfig> &servers,
+                              ListenerIndex &listeners);
+  void _streamBlock(const char *data, size_t size, WebserverConfig &server);
+  static void _createServerTask(size_t index, void *context);
 
 public:
   ServerConfigParser(void);
@@ -26,16 +101,111 @@ public:
   ServerConfigParser &operator=(const ServerConfigParser &other);
   ~ServerConfigParser();
 
+  static const size_t kStreamChunkSize = 64 * 1024;
+  static const size_t kDefaultProbeThreads = 8;
+
+  // `include <glob>;` is expanded at the top level and in server scope;
+  // see IncludeExpander. Included files stay cached (see
+  // getFragmentCache()) for the next createCluster.
   int createCluster(const std::string &config_path);
-  void splitServers(std::string &content);
-  void removeComments(std::string &content);
-  void removeWhitespaces(std::string &content);
-  size_t locateServerStart(std::string &content, size_t pos);
-  size_t locateServerEnd(std::string &content, size_t pos);
-  void createServer(std::string &server_config, WebserverConfig &server);
+  // Bounded-memory alternative to createCluster: the file is read in chunks
+  // and each server block is parsed and passed to `callback` once its
+  // closing brace has been read, so memory follows the largest block rather
+  // than the file. Include directives are not expanded here. Servers are
+  // not kept in getServers(). Returns the number
+  // of servers delivered; on error the callback may already have seen the
+  // servers before the failing block.
+  size_t streamCluster(const std::string &config_path, ServerCallback callback,
+                       void *context, size_t chunk_size = kStreamChunkSize);
+  void splitServers(void);
+  void createServer(const TokenRange &block, WebserverConfig &server);
   void checkServers(void);
-  std::vector<WebserverConfig> getServers() const;
+  // Throws "Failed server validation: ..." naming the first two servers
+  // that listen on the same host and port. Linear in the server count.
+  static void checkServers(const std::vector<WebserverConfig> &servers);
+  // Valid until the next parse or the parser's destruction. After a lazy
+  // parse, only the servers built so far, in the order they were built.
+  const std::vector<WebserverConfig> &getServers() const;
+  // Server blocks found by the last createCluster.
+  size_t getServerCount(void) const;
+  // The server of the index-th block, in file order. After a lazy parse it
+  // is built and validated here the first time it is asked for, so this
+  // may throw what createCluster would have; a failed server is tried
+  // again on the next call. References stay valid until the next parse or
+  // materializeServers().
+  const WebserverConfig &getServer(size_t index);
+  // The server listening on host:port (network byte order, as parsed), or
+  // NULL. Built on first use, as getServer.
+  const WebserverConfig *findServer(in_addr_t host, uint16_t port);
+  // Builds every server a lazy parse left out, leaving getServers() as a
+  // full createCluster would. Does nothing otherwise.
+  void materializeServers(void);
+  // Hands the parsed servers to the caller and leaves the parser empty. An
+  // arena-backed cluster is copied out, since the arena stays behind.
+  void releaseServers(std::vector<WebserverConfig> &servers);
+  // Compiles the cluster (built in full first, as releaseServers does)
+  // into `shared`, one read-only copy that forked workers map instead of
+  // each keeping its own.
+  void publishServers(SharedConfig &shared);
   int print(std::ostream &out) const;
+
+  // Number of threads used to parse server blocks; 1 (the default) keeps
+  // the serial path, 0 uses one thread per online CPU.
+  void setThreads(size_t threads);
+  size_t getThreads(void) const;
+  // Filesystem requirements found while parsing (index files, error pages,
+  // return/alias targets, CGI interpreters) are collected per server and
+  // probed in one batch after every block has been parsed, on this many
+  // threads (0: one per online CPU). Probes wait on the disk, not the CPU,
+  // so the default is above the typical core count. Roots are still probed
+  // inline, since they decide the values later paths are built from.
+  void setProbeThreads(size_t threads);
+  size_t getProbeThreads(void) const;
+  // When enabled, everything createCluster builds (servers, locations,
+  // tokens) is allocated from one ParseArena owned by the parser and freed
+  // at once by the next parse or the destructor. References obtained from
+  // getServers() die with it; copies made outside the parse are ordinary
+  // heap objects.
+  void setUseArena(bool enabled);
+  bool getUseArena(void) const;
+  const ParseArena &getArena(void) const;
+  // Backend every probe of a parse goes to (not owned). NULL, the default,
+  // keeps whatever FileSystem is active on the calling thread: the real one
+  // unless a FileSystemScope says otherwise.
+  void setFileSystem(FileSystem *filesystem);
+  FileSystem *getFileSystem(void) const;
+  // Filesystem probes of the last parse; cleared when the next one starts.
+  const ProbeCache &getProbeCache(void) const;
+  // Roots and indexes interned by the last parse; cleared when the next one
+  // starts.
+  const StringInterner &getInterner(void) const;
+  // When on (the default), createCluster keeps a digest of every server
+  // block and a later call takes over the validated server of a block
+  // whose tokens did not change, instead of parsing and probing it again:
+  // a reload costs what changed. Files the kept servers reference are not
+  // checked again. Not used with the arena or releaseServers(), where the
+  // previous servers are gone, nor after the backend or working directory
+  // changed.
+  void setIncremental(bool enabled);
+  bool getIncremental(void) const;
+  // Servers the last createCluster took over unchanged.
+  size_t getReusedServers(void) const;
+  // When on, createCluster only splits the file into server blocks and
+  // reads each block's listen key (listen, host) to find clashes; the rest
+  // of every block is parsed and its files are probed by the first
+  // getServer/findServer that needs it. Startup then costs about one scan
+  // of the file, and a broken block only fails when it is reached: keep a
+  // full createCluster (or --batch) for CI. Off by default. A block
+  // without a listen port fails the lazy parse with "Port not found".
+  void setLazy(bool enabled);
+  bool getLazy(void) const;
+  // Included files, kept across parses and reloaded only when their size
+  // or mtime changes. They are read on the probe threads.
+  const FragmentCache &getFragmentCache(void) const;
+  // Files the last createCluster read: the configuration, then its
+  // includes, each stamped when it was read. What a snapshot of the cluster
+  // depends on (ConfigSnapshot).
+  const std::vector<ConfigSource> &getSources(void) const;
 };
 
 #endif
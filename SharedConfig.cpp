@@ -0,0 +1,111 @@
+#include "SharedConfig.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+const char kSegmentName[] = "webserv-config";
+
+// A descriptor for an anonymous file that can be sealed when the kernel
+// supports it.
+int createSegment(bool &sealable) {
+  const int fd = memfd_create(kSegmentName, MFD_ALLOW_SEALING);
+  sealable = (fd >= 0);
+  if (fd >= 0 || errno != ENOSYS)
+    return fd;
+  char path[] = "/tmp/webserv-config-XXXXXX";
+  const int file = mkstemp(path);
+  if (file >= 0)
+    unlink(path);
+  return file;
+}
+
+bool writeAll(int fd, const std::string &bytes) {
+  size_t written = 0;
+  while (written < bytes.size()) {
+    const ssize_t got =
+        ::write(fd, bytes.data() + written, bytes.size() - written);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0)
+      return false;
+    written += static_cast<size_t>(got);
+  }
+  return true;
+}
+} // namespace
+
+SharedConfig::SharedConfig(void)
+    : _fd(-1), _mapping(NULL), _size(0), _snapshot() {}
+
+SharedConfig::~SharedConfig() { close(); }
+
+void SharedConfig::publish(const std::vector<WebserverConfig> &servers,
+                           const std::vector<ConfigSource> &sources) {
+  const std::string image = ConfigSnapshot::compile(servers, sources);
+  close();
+  bool sealable = false;
+  _fd = createSegment(sealable);
+  if (_fd < 0)
+    throw std::runtime_error("Could not create the shared config segment");
+  if (!writeAll(_fd, image) ||
+      (sealable && fcntl(_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+                                               F_SEAL_WRITE | F_SEAL_SEAL))) {
+    close();
+    throw std::runtime_error("Could not fill the shared config segment");
+  }
+  _map(kSegmentName);
+}
+
+void SharedConfig::map(int fd) {
+  close();
+  _fd = dup(fd);
+  if (_fd < 0)
+    throw std::runtime_error("Could not map the shared config segment");
+  _map(kSegmentName);
+}
+
+void SharedConfig::_map(const std::string &name) {
+  struct stat buffer;
+  if (fstat(_fd, &buffer) != 0 || buffer.st_size <= 0) {
+    close();
+    throw std::runtime_error("Shared config segment is empty: " + name);
+  }
+  _size = static_cast<size_t>(buffer.st_size);
+  _mapping = mmap(NULL, _size, PROT_READ, MAP_SHARED, _fd, 0);
+  if (_mapping == MAP_FAILED) {
+    _mapping = NULL;
+    close();
+    throw std::runtime_error("Could not map the shared config segment");
+  }
+  try {
+    _snapshot.attach(static_cast<const char *>(_mapping), _size, name);
+  } catch (...) {
+    close();
+    throw;
+  }
+}
+
+void SharedConfig::close(void) {
+  _snapshot.close();
+  if (_mapping)
+    munmap(_mapping, _size);
+  if (_fd >= 0)
+    ::close(_fd);
+  _mapping = NULL;
+  _size = 0;
+  _fd = -1;
+}
+
+int SharedConfig::getDescriptor(void) const { return _fd; }
+
+size_t SharedConfig::size(void) const { return _size; }
+
+const ConfigSnapshot &SharedConfig::getSnapshot(void) const {
+  return _snapshot;
+}
@@ -0,0 +1,48 @@
+#ifndef SHAREDCONFIG_HPP
+#define SHAREDCONFIG_HPP
+
+#include <string>
+#include <vector>
+
+#include "ConfigSnapshot.hpp"
+#include "WebserverConfig.hpp"
+
+// A compiled cluster (the ConfigSnapshot image) published once into a
+// sealed, read-only shared memory segment. Worker processes forked after
+// publish() read the same physical pages through the inherited mapping;
+// others can map() the descriptor when it is passed to them. Nothing in the
+// image is a pointer, so it reads the same at any address.
+class SharedConfig {
+private:
+  int _fd;
+  void *_mapping;
+  size_t _size;
+  ConfigSnapshot _snapshot;
+
+  SharedConfig(const SharedConfig &other);
+  SharedConfig &operator=(const SharedConfig &other);
+
+  void _map(const std::string &name);
+
+public:
+  SharedConfig(void);
+  ~SharedConfig();
+
+  // Compiles `servers` into a memfd (an unlinked temporary file where
+  // memfd_create is missing), seals it against writes and resizing, and
+  // maps it read-only. Replaces what was published before.
+  void publish(const std::vector<WebserverConfig> &servers,
+               const std::vector<ConfigSource> &sources);
+  // Maps a segment another process published; `fd` is duplicated, the
+  // caller keeps its own. Checked like ConfigSnapshot::attach.
+  void map(int fd);
+  void close(void);
+
+  // -1 when nothing is published. Not close-on-exec: hand it to the
+  // workers that should map it.
+  int getDescriptor(void) const;
+  size_t size(void) const;
+  const ConfigSnapshot &getSnapshot(void) const;
+};
+
+#endif
@@ -0,0 +1,189 @@
+#include "StringInterner.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+
+#include "ParseArena.hpp"
+
+struct InternedString::Node {
+  size_t refs;
+  std::string value;
+
+  Node(const StringSpan &text) : refs(1), value(text.data, text.length) {}
+};
+
+namespace {
+__thread StringInterner *t_active_interner = NULL;
+
+const size_t kMinSlots = 16;
+
+class LockGuard {
+private:
+  pthread_mutex_t &_mutex;
+
+  LockGuard(const LockGuard &other);
+  LockGuard &operator=(const LockGuard &other);
+
+public:
+  LockGuard(pthread_mutex_t &mutex) : _mutex(mutex) {
+    pthread_mutex_lock(&_mutex);
+  }
+  ~LockGuard() { pthread_mutex_unlock(&_mutex); }
+};
+
+// FNV-1a.
+uint64_t hashValue(const char *data, size_t length) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; ++i)
+    hash = (hash ^ static_cast<unsigned char>(data[i])) * 1099511628211ULL;
+  return hash;
+}
+} // namespace
+
+InternedString::InternedString(void) : _node(NULL) {}
+
+InternedString::InternedString(const StringSpan &value) : _node(NULL) {
+  if (!value.length)
+    return;
+  StringInterner *interner = StringInterner::active();
+  if (!interner) {
+    _node = _make(value);
+    return;
+  }
+  InternedString shared = interner->intern(value);
+  std::swap(_node, shared._node);
+}
+
+InternedString::InternedString(const InternedString &other)
+    : _node(other._node) {
+  if (_node)
+    __sync_fetch_and_add(&_node->refs, 1);
+}
+
+InternedString &InternedString::operator=(const InternedString &other) {
+  InternedString copy(other);
+  std::swap(_node, copy._node);
+  return (*this);
+}
+
+InternedString::~InternedString() {
+  if (_node && __sync_sub_and_fetch(&_node->refs, 1) == 0)
+    delete _node;
+}
+
+// On the heap even while an arena is active: copies of a server built in
+// the arena may keep the value after the arena is released.
+InternedString::Node *InternedString::_make(const StringSpan &value) {
+  ArenaScope heap(NULL);
+  return new Node(value);
+}
+
+const std::string &InternedString::str(void) const {
+  static const std::string empty;
+  return _node ? _node->value : empty;
+}
+
+void InternedString::swap(InternedString &other) {
+  std::swap(_node, other._node);
+}
+
+StringInterner::StringInterner(void) : _slots() {
+  std::memset(&_stats, 0, sizeof(_stats));
+  pthread_mutex_init(&_lock, NULL);
+}
+
+StringInterner::StringInterner(const StringInterner &other) : _slots() {
+  pthread_mutex_init(&_lock, NULL);
+  LockGuard guard(other._lock);
+  ArenaScope heap(NULL);
+  _slots = other._slots;
+  _stats = other._stats;
+}
+
+StringInterner &StringInterner::operator=(const StringInterner &other) {
+  if (this != &other) {
+    std::vector<InternedString> slots;
+    Stats stats;
+    {
+      LockGuard guard(other._lock);
+      ArenaScope heap(NULL);
+      slots = other._slots;
+      stats = other._stats;
+    }
+    LockGuard guard(_lock);
+    _slots.swap(slots);
+    _stats = stats;
+  }
+  return (*this);
+}
+
+StringInterner::~StringInterner() { pthread_mutex_destroy(&_lock); }
+
+size_t StringInterner::_find(const char *data, size_t length) const {
+  const size_t mask = _slots.size() - 1;
+  size_t slot = hashValue(data, length) & mask;
+  while (_slots[slot]._node &&
+         (_slots[slot]._node->value.size() != length ||
+          std::memcmp(_slots[slot]._node->value.data(), data, length) != 0))
+    slot = (slot + 1) & mask;
+  return slot;
+}
+
+// On the heap, like the values, so a table kept across an arena parse
+// never points into the arena. The entries move over without touching
+// their reference counts.
+void StringInterner::_grow(void) {
+  ArenaScope heap(NULL);
+  std::vector<InternedString> old(
+      _slots.empty() ? kMinSlots : _slots.size() * 2);
+  old.swap(_slots);
+  for (size_t i = 0; i < old.size(); ++i) {
+    if (!old[i]._node)
+      continue;
+    const std::string &value = old[i]._node->value;
+    std::swap(_slots[_find(value.data(), value.size())]._node, old[i]._node);
+  }
+}
+
+InternedString StringInterner::intern(const StringSpan &value) {
+  if (!value.length)
+    return (InternedString());
+  LockGuard guard(_lock);
+  ++_stats.lookups;
+  _stats.requested_bytes += value.length + 1;
+  if ((_stats.strings + 1) * 2 > _slots.size())
+    _grow();
+  InternedString &slot = _slots[_find(value.data, value.length)];
+  if (!slot._node) {
+    slot._node = InternedString::_make(value);
+    ++_stats.strings;
+    _stats.stored_bytes += value.length + 1;
+  }
+  return (slot);
+}
+
+void StringInterner::clear(void) {
+  std::vector<InternedString> slots;
+  LockGuard guard(_lock);
+  _slots.swap(slots);
+  std::memset(&_stats, 0, sizeof(_stats));
+}
+
+StringInterner::Stats StringInterner::readStats(void) const {
+  LockGuard guard(_lock);
+  return (_stats);
+}
+
+StringInterner *StringInterner::active(void) { return t_active_interner; }
+
+StringInterner *StringInterner::activate(StringInterner *interner) {
+  StringInterner *previous = t_active_interner;
+  t_active_interner = interner;
+  return previous;
+}
+
+InternScope::InternScope(StringInterner *interner)
+    : _previous(StringInterner::activate(interner)) {}
+
+InternScope::~InternScope() { StringInterner::activate(_previous); }
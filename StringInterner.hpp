@@ -0,0 +1,89 @@
+#ifndef STRINGINTERNER_HPP
+#define STRINGINTERNER_HPP
+
+#include <cstddef>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "ParserUtils.hpp"
+
+// An immutable string whose characters live in one refcounted heap copy,
+// shared by every InternedString made from it; the last one frees it. The
+// copy is allocated outside any ParseArena, so it outlasts the parse that
+// made it. Copies may be made and dropped on different threads.
+class InternedString {
+private:
+  struct Node;
+
+  Node *_node; // NULL for ""
+
+  static Node *_make(const StringSpan &value);
+
+  friend class StringInterner;
+
+public:
+  InternedString(void);
+  // Shares the copy held by the StringInterner active on this thread (see
+  // InternScope), adding `value` to it first if needed; with none active,
+  // a copy of its own.
+  explicit InternedString(const StringSpan &value);
+  InternedString(const InternedString &other);
+  InternedString &operator=(const InternedString &other);
+  ~InternedString();
+
+  const std::string &str(void) const;
+  void swap(InternedString &other);
+};
+
+// Per-parse table of the values a cluster repeats over and over: roots,
+// indexes, error pages and CGI interpreters. Equal values interned into one
+// table share one InternedString, so a location that inherits its server's
+// root, or a hundred servers with the same index, hold a single copy. The table only holds references:
+// clear() or destroying it leaves the servers' values alone. Safe to share
+// between the worker threads of one parse.
+class StringInterner {
+public:
+  struct Stats {
+    size_t lookups;         // intern() calls with a non-empty value
+    size_t strings;         // distinct values stored
+    size_t stored_bytes;    // characters held, terminators included
+    size_t requested_bytes; // the same for every lookup, as if each copied
+  };
+
+private:
+  std::vector<InternedString> _slots; // open addressing, at most half full
+  Stats _stats;
+  mutable pthread_mutex_t _lock;
+
+  void _grow(void);
+  size_t _find(const char *data, size_t length) const;
+
+public:
+  StringInterner(void);
+  StringInterner(const StringInterner &other);
+  StringInterner &operator=(const StringInterner &other);
+  ~StringInterner();
+
+  InternedString intern(const StringSpan &value);
+  void clear(void);
+  Stats readStats(void) const;
+
+  static StringInterner *active(void);
+  static StringInterner *activate(StringInterner *interner);
+};
+
+// Makes `interner` the active string interner of this thread for the scope.
+class InternScope {
+private:
+  StringInterner *_previous;
+
+  InternScope(const InternScope &other);
+  InternScope &operator=(const InternScope &other);
+
+public:
+  InternScope(StringInterner *interner);
+  ~InternScope();
+};
+
+#endif
@@ -0,0 +1,272 @@
+#include "ValidationPlan.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "ConfigurationFile.hpp"
+#include "FileSystem.hpp"
+#include "ParseArena.hpp"
+#include "ProbeCache.hpp"
+
+namespace {
+__thread ValidationPlan *t_active_plan = NULL;
+
+std::string formatMessage(const char *message, const std::string &path) {
+  std::string result(message ? message : "");
+  const size_t slot = result.find("%s");
+  if (slot != std::string::npos)
+    result.replace(slot, 2, path);
+  return result;
+}
+
+bool hasType(const DirectoryHandle &base, const std::string &path, int type) {
+  const int actual = ConfigurationFile::getTypeAt(base, path);
+  return (type ? actual == type : actual >= 0);
+}
+
+bool passesModes(const DirectoryHandle &base, const std::string &path,
+                 unsigned char modes) {
+  for (int mode = 0; mode < 8; ++mode) {
+    if ((modes & (1U << mode)) &&
+        ConfigurationFile::checkFileAt(base, path, mode))
+      return false;
+  }
+  return true;
+}
+
+struct ProbeTarget {
+  const DirectoryHandle *base;
+  const std::string *path;
+  unsigned char modes;
+};
+
+ProbeTarget makeTarget(const DirectoryHandle &base, const std::string &path,
+                       unsigned char modes) {
+  ProbeTarget target;
+  target.base = &base;
+  target.path = &path;
+  target.modes = modes;
+  return target;
+}
+
+// Orders by root descriptor, then path. Two unopened roots compare equal
+// on the descriptor, which at worst leaves a path unprefetched; evaluation
+// probes it anyway.
+bool comparePaths(const ProbeTarget &left, const ProbeTarget &right) {
+  const int left_base = left.base->getDescriptor();
+  const int right_base = right.base->getDescriptor();
+  if (left_base != right_base)
+    return (left_base < right_base);
+  return (*left.path < *right.path);
+}
+
+bool samePath(const ProbeTarget &left, const ProbeTarget &right) {
+  return (left.base->getDescriptor() == right.base->getDescriptor() &&
+          *left.path == *right.path);
+}
+
+// The distinct paths of a batch, each with the access modes asked of it.
+// Paths point into the plans, which outlive the batch.
+struct ProbeBatch {
+  std::vector<ProbeTarget> paths;
+  ParseArena *arena;
+  FileSystem *filesystem;
+  ProbeCache *cache;
+};
+
+void probeTask(size_t index, void *context) {
+  ProbeBatch &batch = *static_cast<ProbeBatch *>(context);
+  ArenaScope arena(batch.arena);
+  FileSystemScope filesystem(batch.filesystem);
+  ProbeScope scope(batch.cache);
+  const ProbeTarget &target = batch.paths[index];
+  if (ConfigurationFile::getTypeAt(*target.base, *target.path) < 0)
+    return;
+  passesModes(*target.base, *target.path, target.modes);
+}
+} // namespace
+
+PathCheck::PathCheck(void)
+    : count(0), type(1), modes(0), match(ANY_CANDIDATE), guard_dir(),
+      guard_base(), missing(NULL), denied(NULL) {}
+
+PathCheck::PathCheck(const PathCheck &other)
+    : count(other.count), type(other.type), modes(other.modes),
+      match(other.match), guard_dir(other.guard_dir),
+      guard_base(other.guard_base), missing(other.missing),
+      denied(other.denied) {
+  for (size_t i = 0; i < count; ++i) {
+    candidates[i] = other.candidates[i];
+    bases[i] = other.bases[i];
+  }
+}
+
+PathCheck &PathCheck::operator=(const PathCheck &other) {
+  if (this != &other) {
+    for (size_t i = 0; i < other.count; ++i) {
+      candidates[i] = other.candidates[i];
+      bases[i] = other.bases[i];
+    }
+    count = other.count;
+    type = other.type;
+    modes = other.modes;
+    match = other.match;
+    guard_dir = other.guard_dir;
+    guard_base = other.guard_base;
+    missing = other.missing;
+    denied = other.denied;
+  }
+  return (*this);
+}
+
+PathCheck::~PathCheck() {}
+
+void PathCheck::addCandidate(const std::string &path) {
+  addCandidate(DirectoryHandle(), path);
+}
+
+void PathCheck::addCandidate(const DirectoryHandle &base,
+                             const std::string &relative) {
+  if (count < sizeof(candidates) / sizeof(candidates[0])) {
+    bases[count] = base;
+    candidates[count++] = relative;
+  }
+}
+
+std::string PathCheck::describe(size_t index) const {
+  if (bases[index].empty())
+    return candidates[index];
+  return bases[index].join(candidates[index]);
+}
+
+std::string PathCheck::evaluate(void) const {
+  if (!guard_dir.empty() &&
+      ConfigurationFile::getTypeAt(guard_base, guard_dir) != 2)
+    return "";
+  for (size_t i = 0; i < count; ++i) {
+    if (!hasType(bases[i], candidates[i], type))
+      continue;
+    if (passesModes(bases[i], candidates[i], modes))
+      return "";
+    if (match == FIRST_OF_TYPE)
+      return formatMessage(denied, describe(i));
+  }
+  if (!count)
+    return formatMessage(missing, guard_base.empty()
+                                      ? guard_dir
+                                      : guard_base.join(guard_dir));
+  return formatMessage(missing, describe(count - 1));
+}
+
+ValidationPlan::ValidationPlan(void) : _checks() {}
+
+ValidationPlan::ValidationPlan(const ValidationPlan &other)
+    : _checks(other._checks) {}
+
+ValidationPlan &ValidationPlan::operator=(const ValidationPlan &other) {
+  if (this != &other)
+    _checks = other._checks;
+  return (*this);
+}
+
+ValidationPlan::~ValidationPlan() {}
+
+void ValidationPlan::add(const PathCheck &check) { _checks.push_back(check); }
+
+void ValidationPlan::clear(void) { _checks.clear(); }
+
+size_t ValidationPlan::size(void) const { return _checks.size(); }
+
+const PathCheck &ValidationPlan::at(size_t index) const {
+  return _checks[index];
+}
+
+ValidationPlan *ValidationPlan::active(void) { return t_active_plan; }
+
+ValidationPlan *ValidationPlan::activate(ValidationPlan *plan) {
+  ValidationPlan *previous = t_active_plan;
+  t_active_plan = plan;
+  return previous;
+}
+
+PlanScope::PlanScope(ValidationPlan *plan)
+    : _previous(ValidationPlan::activate(plan)) {}
+
+PlanScope::~PlanScope() { ValidationPlan::activate(_previous); }
+
+PathCheck readableFileCheck(const DirectoryHandle &dir,
+                            const std::string &file, const char *missing) {
+  PathCheck check;
+  check.addCandidate(file);
+  // With a leading '/' this is the same file as the one below `dir`.
+  if (!dir.empty() && (file.empty() || file[0] != '/'))
+    check.addCandidate(dir.getPath() + file);
+  check.addCandidate(dir, file);
+  check.type = 1;
+  check.modes = accessBit(R_OK);
+  check.missing = missing;
+  return check;
+}
+
+bool requirePath(const PathCheck &check, std::string &error) {
+  ValidationPlan *plan = ValidationPlan::active();
+  if (plan) {
+    plan->add(check);
+    return true;
+  }
+  error = check.evaluate();
+  return error.empty();
+}
+
+void validatePlans(const std::vector<ValidationPlan> &plans,
+                   WorkerPool &pool) {
+  ProbeCache *cache = ProbeCache::active();
+  if (cache) {
+    // Sorted and merged in one vector of pointers rather than a map: one
+    // allocation instead of a node and a string copy per path.
+    ProbeBatch batch;
+    size_t total = 0;
+    for (size_t p = 0; p < plans.size(); ++p) {
+      for (size_t c = 0; c < plans[p].size(); ++c)
+        total += plans[p].at(c).count + 1;
+    }
+    batch.paths.reserve(total);
+    for (size_t p = 0; p < plans.size(); ++p) {
+      for (size_t c = 0; c < plans[p].size(); ++c) {
+        const PathCheck &check = plans[p].at(c);
+        if (!check.guard_dir.empty())
+          batch.paths.push_back(
+              makeTarget(check.guard_base, check.guard_dir, 0));
+        for (size_t i = 0; i < check.count; ++i)
+          batch.paths.push_back(
+              makeTarget(check.bases[i], check.candidates[i], check.modes));
+      }
+    }
+    std::sort(batch.paths.begin(), batch.paths.end(), &comparePaths);
+    size_t kept = 0;
+    for (size_t i = 0; i < batch.paths.size(); ++i) {
+      if (kept && samePath(batch.paths[kept - 1], batch.paths[i]))
+        batch.paths[kept - 1].modes |= batch.paths[i].modes;
+      else
+        batch.paths[kept++] = batch.paths[i];
+    }
+    batch.paths.resize(kept);
+    batch.arena = ParseArena::active();
+    batch.filesystem = FileSystem::active();
+    batch.cache = cache;
+    if (batch.paths.size() < kInlineProbes) {
+      for (size_t i = 0; i < batch.paths.size(); ++i)
+        probeTask(i, &batch);
+    } else {
+      pool.run(batch.paths.size(), &probeTask, &batch);
+    }
+  }
+  for (size_t p = 0; p < plans.size(); ++p) {
+    for (size_t c = 0; c < plans[p].size(); ++c) {
+      const std::string error = plans[p].at(c).evaluate();
+      if (!error.empty())
+        throw std::runtime_error(error);
+    }
+  }
+}
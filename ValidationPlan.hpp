@@ -0,0 +1,107 @@
+#ifndef VALIDATIONPLAN_HPP
+#define VALIDATIONPLAN_HPP
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "FileSystem.hpp"
+#include "WorkerPool.hpp"
+
+// One filesystem requirement found while parsing, e.g. "the first regular
+// file among these candidates must be readable". A candidate is a path, or
+// a path below an opened root (probed with fstatat/faccessat). Messages may
+// contain "%s": `missing` gets the last candidate, `denied` the candidate
+// that was chosen, both spelled as joined paths.
+struct PathCheck {
+  enum Match {
+    ANY_CANDIDATE, // passes if some candidate has `type` and `modes`
+    FIRST_OF_TYPE  // the first candidate with `type` must pass `modes`
+  };
+
+  std::string candidates[3];
+  DirectoryHandle bases[3]; // empty: the candidate is a plain path
+  size_t count;
+  int type;            // getTypePath() result required; 0 accepts any
+  unsigned char modes; // bit m: access(candidate, m) must succeed
+  Match match;
+  // If set, the check only applies when this (below guard_base, if that is
+  // set) is a directory.
+  std::string guard_dir;
+  DirectoryHandle guard_base;
+  const char *missing;
+  const char *denied;
+
+  PathCheck(void);
+  PathCheck(const PathCheck &other);
+  PathCheck &operator=(const PathCheck &other);
+  ~PathCheck();
+
+  void addCandidate(const std::string &path);
+  void addCandidate(const DirectoryHandle &base, const std::string &relative);
+  // The candidate as one path, for messages.
+  std::string describe(size_t index) const;
+  // Empty when the requirement holds, otherwise the formatted message.
+  std::string evaluate(void) const;
+};
+
+// Requirements recorded while one server block is parsed. With a plan
+// active on the thread (PlanScope), validation code records its checks
+// here instead of probing the disk; ServerConfigParser later runs every
+// plan in one batch (see validatePlans).
+class ValidationPlan {
+private:
+  // A deque so growing never copies the recorded paths.
+  std::deque<PathCheck> _checks;
+
+public:
+  ValidationPlan(void);
+  ValidationPlan(const ValidationPlan &other);
+  ValidationPlan &operator=(const ValidationPlan &other);
+  ~ValidationPlan();
+
+  void add(const PathCheck &check);
+  void clear(void);
+  size_t size(void) const;
+  const PathCheck &at(size_t index) const;
+
+  static ValidationPlan *active(void);
+  static ValidationPlan *activate(ValidationPlan *plan);
+};
+
+class PlanScope {
+private:
+  ValidationPlan *_previous;
+
+  PlanScope(const PlanScope &other);
+  PlanScope &operator=(const PlanScope &other);
+
+public:
+  PlanScope(ValidationPlan *plan);
+  ~PlanScope();
+};
+
+inline unsigned char accessBit(int mode) {
+  return static_cast<unsigned char>(1U << mode);
+}
+
+// The requirement ConfigurationFile::doesFileExistAndIsReadable tests:
+// `file` as given, `dir` + `file`, or `file` below `dir` is a readable
+// regular file.
+PathCheck readableFileCheck(const DirectoryHandle &dir,
+                            const std::string &file, const char *missing);
+
+// Records `check` in the active plan and returns true, or, with no plan
+// active, evaluates it right away: false (and `error` set) when it fails.
+bool requirePath(const PathCheck &check, std::string &error);
+
+// Probes every distinct path the plans mention on `pool`, filling the
+// calling thread's active ProbeCache, then evaluates the checks in plan
+// order from the cache. Throws the first failure. Batches of fewer than
+// kInlineProbes paths (one streamed or lazily built server, typically) are
+// probed on the calling thread: waking the pool would cost more.
+static const size_t kInlineProbes = 64;
+void validatePlans(const std::vector<ValidationPlan> &plans, WorkerPool &pool);
+
+#endif
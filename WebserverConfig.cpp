@@ -1,45 +1,223 @@
 #include "WebserverConfig.hpp"
 
+#include <algorithm>
 #include <cerrno>
 #include <stdexcept>
 #include <unistd.h>
 
+#include "DirectiveTable.hpp"
+#include "ValidationPlan.hpp"
+
 namespace {
-std::string normalizeDirective(std::string value, const std::string &context) {
-  value = trimWhitespace(value);
-  enforceTrailingSemicolon(value, context);
-  value = trimWhitespace(value);
-  return value;
-}
-
-std::string joinPaths(const std::string &base, const std::string &relative) {
-  if (relative.empty())
-    return base;
-  std::string rel = relative;
-  if (!rel.empty() && rel[0] == '/')
-    rel.erase(0, 1);
-  if (base.empty())
-    return rel;
-  if (base[base.size() - 1] == '/')
-    return base + rel;
-  return base + "/" + rel;
+StringSpan normalizeDirective(const StringSpan &value, const char *context) {
+  return trimWhitespace(stripTrailingSemicolon(trimWhitespace(value), context));
+}
+
+struct LocationScope {
+  const ConfigLexer &tokens;
+  const TokenRange &parameters;
+  const std::string &server_root;
+  LocationBlock &location;
+
+  LocationScope(const ConfigLexer &lexer, const TokenRange &range,
+                const std::string &root, LocationBlock &block)
+      : tokens(lexer), parameters(range), server_root(root), location(block) {}
+};
+
+struct LocationDirective {
+  const char *name;
+  void (*handler)(LocationScope &, size_t &);
+  int duplicate_bit;
+  const char *duplicate_error;
+  const char *cgi_error; // set when the directive is refused in /cgi-bin
+};
+
+// Reads a value list up to (and including) the token that carries ';'.
+void collectValues(LocationScope &scope, size_t &index, const char *context,
+                   std::vector<StringSpan> &values) {
+  while (++index < scope.parameters.end) {
+    if (scope.tokens.isTerminated(index)) {
+      values.push_back(normalizeDirective(scope.tokens.text(index), context));
+      return;
+    }
+    values.push_back(scope.tokens.text(index));
+    if (index + 1 >= scope.parameters.end)
+      throw std::runtime_error("Token is invalid");
+  }
+}
+
+void setLocationRoot(LocationScope &scope, size_t &index) {
+  std::string value =
+      normalizeDirective(scope.tokens.text(++index), "location root").str();
+  if (ConfigurationFile::getTypePath(value) == 2)
+    scope.location.setRoot(value);
+  else
+    scope.location.setRoot(joinPaths(scope.server_root, value));
+}
+
+// Probes `relative` below the location root through its open handle; a
+// location without a root falls back to the joined path.
+int typeBelowRoot(const LocationBlock &location, const std::string &relative) {
+  if (location.getRootDirectory().empty())
+    return ConfigurationFile::getTypePath(
+        joinPaths(location.getRoot(), relative));
+  return ConfigurationFile::getTypeAt(location.getRootDirectory(), relative);
+}
+
+int checkBelowRoot(const LocationBlock &location, const std::string &relative,
+                   int mode) {
+  if (location.getRootDirectory().empty())
+    return ConfigurationFile::checkFile(joinPaths(location.getRoot(), relative),
+                                        mode);
+  return ConfigurationFile::checkFileAt(location.getRootDirectory(), relative,
+                                        mode);
+}
+
+void setLocationMethods(LocationScope &scope, size_t &index) {
+  std::vector<StringSpan> methods;
+  collectValues(scope, index, "allow_methods", methods);
+  scope.location.setMethods(methods);
+}
+
+void setLocationAutoindex(LocationScope &scope, size_t &index) {
+  scope.location.setAutoindex(
+      normalizeDirective(scope.tokens.text(++index), "location autoindex"));
+}
+
+void setLocationIndex(LocationScope &scope, size_t &index) {
+  scope.location.setIndex(
+      normalizeDirective(scope.tokens.text(++index), "location index"));
+}
+
+void setLocationReturn(LocationScope &scope, size_t &index) {
+  scope.location.setReturn(
+      normalizeDirective(scope.tokens.text(++index), "location return").str());
+}
+
+void setLocationAlias(LocationScope &scope, size_t &index) {
+  scope.location.setAlias(
+      normalizeDirective(scope.tokens.text(++index), "location alias").str());
+}
+
+void setLocationCgiExtensions(LocationScope &scope, size_t &index) {
+  std::vector<StringSpan> values;
+  collectValues(scope, index, "cgi_ext", values);
+  std::vector<std::string> extensions;
+  for (size_t i = 0; i < values.size(); ++i)
+    extensions.push_back(values[i].str());
+  scope.location.setCgiExtensions(extensions);
+}
+
+void setLocationCgiPaths(LocationScope &scope, size_t &index) {
+  std::vector<StringSpan> values;
+  collectValues(scope, index, "cgi_path", values);
+  for (size_t i = 0; i < values.size(); ++i) {
+    if (!values[i].contains("/python") && !values[i].contains("/bash"))
+      throw std::runtime_error("cgi_path is invalid");
+  }
+  scope.location.setCgiPaths(values);
+}
+
+void setLocationMaxBodySize(LocationScope &scope, size_t &index) {
+  scope.location.setMaxBodySize(normalizeDirective(
+      scope.tokens.text(++index), "location client_max_body_size"));
+}
+
+enum LocationDirectiveBit {
+  LOCATION_ROOT,
+  LOCATION_METHODS,
+  LOCATION_AUTOINDEX,
+  LOCATION_INDEX,
+  LOCATION_RETURN,
+  LOCATION_ALIAS,
+  LOCATION_MAX_BODY_SIZE
+};
+
+const LocationDirective kLocationDirectives[] = {
+    {"root", &setLocationRoot, LOCATION_ROOT, "Root of location is duplicated",
+     NULL},
+    {"allow_methods", &setLocationMethods, LOCATION_METHODS,
+     "Allow_methods of location is duplicated", NULL},
+    {"methods", &setLocationMethods, LOCATION_METHODS,
+     "Allow_methods of location is duplicated", NULL},
+    {"allowed_methods", &setLocationMethods, LOCATION_METHODS,
+     "Allow_methods of location is duplicated", NULL},
+    {"autoindex", &setLocationAutoindex, LOCATION_AUTOINDEX,
+     "Autoindex of location is duplicated",
+     "Parametr autoindex not allow for CGI"},
+    {"index", &setLocationIndex, LOCATION_INDEX,
+     "Index of location is duplicated", NULL},
+    {"return", &setLocationReturn, LOCATION_RETURN,
+     "Return of location is duplicated", "Parametr return not allow for CGI"},
+    {"alias", &setLocationAlias, LOCATION_ALIAS,
+     "Alias of location is duplicated", "Parametr alias not allow for CGI"},
+    {"cgi_ext", &setLocationCgiExtensions, kRepeatable, NULL, NULL},
+    {"cgi_path", &setLocationCgiPaths, kRepeatable, NULL, NULL},
+    {"client_max_body_size", &setLocationMaxBodySize, LOCATION_MAX_BODY_SIZE,
+     "Maxbody_size of location is duplicated", NULL},
+};
+
+const DirectiveTable<LocationDirective> &locationDirectives(void) {
+  static const DirectiveTable<LocationDirective> table(kLocationDirectives);
+  return table;
+}
+
+// FNV-1a; paths are short, so hashing every byte is fine.
+size_t hashPath(const std::string &path) {
+  size_t hash = 2166136261U;
+  for (size_t i = 0; i < path.size(); ++i) {
+    hash ^= static_cast<unsigned char>(path[i]);
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+// Open-addressing set over location paths: slots hold index + 1 into
+// `blocks`, 0 is free. Returns the slot for `path`, which is free unless a
+// location with that path was claimed.
+size_t findPath(const std::vector<size_t> &slots,
+                const std::vector<LocationBlock> &blocks,
+                const std::string &path) {
+  const size_t mask = slots.size() - 1;
+  size_t slot = hashPath(path) & mask;
+  while (slots[slot] && blocks[slots[slot] - 1].getPath() != path)
+    slot = (slot + 1) & mask;
+  return slot;
+}
+
+// Sizes `slots` for `count` paths at most half full and re-inserts the
+// first `count` blocks.
+void rehashPaths(std::vector<size_t> &slots,
+                 const std::vector<LocationBlock> &blocks, size_t count) {
+  size_t size = 16;
+  while (size / 2 < count)
+    size *= 2;
+  if (size <= slots.size())
+    return;
+  slots.assign(size, 0);
+  for (size_t i = 0; i < count && i < blocks.size(); ++i)
+    slots[findPath(slots, blocks, blocks[i].getPath())] = i + 1;
 }
 } // namespace
 
 WebserverConfig::WebserverConfig(void)
-    : _port(0), _host(0), _server_name(""), _root(""), _index(""),
+    : _port(0), _host(0), _server_name(""), _root(), _root_directory(),
+      _index(),
       _max_body_size(kDefaultMaxBodySize), _autoindex(false), _error_pages(),
-      _location_blocks(), _server_address(), _listen_fd(-1) {
+      _location_blocks(), _location_slots(), _server_address(),
+      _listen_fd(-1) {
   std::memset(&_server_address, 0, sizeof(_server_address));
   initErrorPages();
 }
 
 WebserverConfig::WebserverConfig(const WebserverConfig &other)
     : _port(other._port), _host(other._host), _server_name(other._server_name),
-      _root(other._root), _index(other._index),
+      _root(other._root), _root_directory(other._root_directory),
+      _index(other._index),
       _max_body_size(other._max_body_size), _autoindex(other._autoindex),
       _error_pages(other._error_pages),
       _location_blocks(other._location_blocks),
+      _location_slots(other._location_slots),
       _server_address(other._server_address), _listen_fd(other._listen_fd) {}
 
 WebserverConfig &WebserverConfig::operator=(const WebserverConfig &other) {
@@ -48,11 +226,13 @@ WebserverConfig &WebserverConfig::operator=(const WebserverConfig &other) {
     _host = other._host;
     _server_name = other._server_name;
     _root = other._root;
+    _root_directory = other._root_directory;
     _index = other._index;
     _max_body_size = other._max_body_size;
     _autoindex = other._autoindex;
     _error_pages = other._error_pages;
     _location_blocks = other._location_blocks;
+    _location_slots = other._location_slots;
     _server_address = other._server_address;
     _listen_fd = other._listen_fd;
   }
@@ -61,239 +241,200 @@ WebserverConfig &WebserverConfig::operator=(const WebserverConfig &other) {
 
 WebserverConfig::~WebserverConfig() {}
 
+void WebserverConfig::swap(WebserverConfig &other) {
+  std::swap(_port, other._port);
+  std::swap(_host, other._host);
+  _server_name.swap(other._server_name);
+  _root.swap(other._root);
+  _root_directory.swap(other._root_directory);
+  _index.swap(other._index);
+  std::swap(_max_body_size, other._max_body_size);
+  std::swap(_autoindex, other._autoindex);
+  _error_pages.swap(other._error_pages);
+  _location_blocks.swap(other._location_blocks);
+  _location_slots.swap(other._location_slots);
+  std::swap(_server_address, other._server_address);
+  std::swap(_listen_fd, other._listen_fd);
+}
+
 void WebserverConfig::initErrorPages(void) {
-  _error_pages[301] = "";
-  _error_pages[302] = "";
-  _error_pages[400] = "";
-  _error_pages[401] = "";
-  _error_pages[402] = "";
-  _error_pages[403] = "";
-  _error_pages[404] = "";
-  _error_pages[405] = "";
-  _error_pages[406] = "";
-  _error_pages[500] = "";
-  _error_pages[501] = "";
-  _error_pages[502] = "";
-  _error_pages[503] = "";
-  _error_pages[505] = "";
-}
-
-void WebserverConfig::setServerName(std::string server_name) {
-  _server_name = normalizeDirective(server_name, "server_name");
-}
-
-void WebserverConfig::setHost(std::string host) {
-  host = normalizeDirective(host, "host");
-  if (host == "localhost")
-    host = "127.0.0.1";
-  if (!isValidHost(host))
+  _error_pages[301] = InternedString();
+  _error_pages[302] = InternedString();
+  _error_pages[400] = InternedString();
+  _error_pages[401] = InternedString();
+  _error_pages[402] = InternedString();
+  _error_pages[403] = InternedString();
+  _error_pages[404] = InternedString();
+  _error_pages[405] = InternedString();
+  _error_pages[406] = InternedString();
+  _error_pages[500] = InternedString();
+  _error_pages[501] = InternedString();
+  _error_pages[502] = InternedString();
+  _error_pages[503] = InternedString();
+  _error_pages[505] = InternedString();
+}
+
+void WebserverConfig::setServerName(const StringSpan &server_name) {
+  _server_name = normalizeDirective(server_name, "server_name").str();
+}
+
+void WebserverConfig::setHost(const StringSpan &host) {
+  _host = parseHost(host);
+}
+
+in_addr_t WebserverConfig::parseHost(const StringSpan &host) {
+  StringSpan value = normalizeDirective(host, "host");
+  if (value == "localhost")
+    value = StringSpan("127.0.0.1");
+  char address[INET_ADDRSTRLEN];
+  if (value.length >= sizeof(address))
     throw std::runtime_error("Wrong syntax: host");
-  _host = inet_addr(host.c_str());
+  std::memcpy(address, value.data, value.length);
+  address[value.length] = '\0';
+  struct in_addr parsed;
+  if (inet_pton(AF_INET, address, &parsed) != 1)
+    throw std::runtime_error("Wrong syntax: host");
+  return parsed.s_addr;
 }
 
-void WebserverConfig::setRoot(std::string root) {
-  root = normalizeDirective(root, "root");
+void WebserverConfig::setRoot(const StringSpan &root_value) {
+  std::string root = normalizeDirective(root_value, "root").str();
   if (ConfigurationFile::getTypePath(root) == 2) {
-    _root = root;
+    _root = InternedString(root);
+    _root_directory = ConfigurationFile::openDirectory(_root.str());
     return;
   }
-  char cwd[1024];
-  if (!getcwd(cwd, sizeof(cwd)))
+  std::string full_root;
+  if (!ConfigurationFile::getCurrentDirectory(full_root))
     throw std::runtime_error("Failed to resolve working directory");
-  std::string full_root = std::string(cwd);
   if (!full_root.empty() && full_root[full_root.size() - 1] != '/')
     full_root += "/";
   full_root += root;
   if (ConfigurationFile::getTypePath(full_root) != 2)
     throw std::runtime_error("Wrong syntax: root");
-  _root = full_root;
+  _root = InternedString(full_root);
+  _root_directory = ConfigurationFile::openDirectory(_root.str());
 }
 
 void WebserverConfig::setFdx(int fd) { _listen_fd = fd; }
 
-void WebserverConfig::setPort(std::string value) {
-  value = normalizeDirective(value, "port");
-  if (!isAllDigits(value))
-    throw std::runtime_error("Wrong syntax: port");
-  unsigned int port = static_cast<unsigned int>(stoiStrict(value));
-  if (port < 1 || port > 65535)
+void WebserverConfig::setPort(const StringSpan &port_value) {
+  _port = parsePort(port_value);
+}
+
+uint16_t WebserverConfig::parsePort(const StringSpan &port_value) {
+  StringSpan value = normalizeDirective(port_value, "port");
+  uint64_t port = 0;
+  if (!parseUnsigned(value, 65535, port) || port < 1)
     throw std::runtime_error("Wrong syntax: port");
-  _port = static_cast<uint16_t>(port);
+  return static_cast<uint16_t>(port);
 }
 
-void WebserverConfig::setClientMaxBodySize(std::string value) {
-  value = normalizeDirective(value, "client_max_body_size");
-  if (!isAllDigits(value))
-    throw std::runtime_error("Wrong syntax: client_max_body_size");
-  size_t size = static_cast<size_t>(stoiStrict(value));
-  if (size == 0)
+void WebserverConfig::setClientMaxBodySize(const StringSpan &size_value) {
+  StringSpan value = normalizeDirective(size_value, "client_max_body_size");
+  uint64_t size = 0;
+  if (!parseSize(value, size) || size == 0)
     throw std::runtime_error("Wrong syntax: client_max_body_size");
   _max_body_size = size;
 }
 
-void WebserverConfig::setIndex(std::string index) {
-  _index = normalizeDirective(index, "index");
+void WebserverConfig::setIndex(const StringSpan &index) {
+  _index = InternedString(normalizeDirective(index, "index"));
 }
 
-void WebserverConfig::setAutoindex(std::string autoindex) {
-  autoindex = normalizeDirective(autoindex, "autoindex");
-  if (autoindex != "on" && autoindex != "off")
+void WebserverConfig::setAutoindex(const StringSpan &autoindex) {
+  StringSpan value = normalizeDirective(autoindex, "autoindex");
+  if (value != "on" && value != "off")
     throw std::runtime_error("Wrong syntax: autoindex");
-  _autoindex = (autoindex == "on");
+  _autoindex = (value == "on");
 }
 
-void WebserverConfig::setErrorPages(std::vector<std::string> error_pages) {
-  if (error_pages.empty())
+void WebserverConfig::setErrorPages(const ConfigLexer &tokens,
+                                    const TokenRange &error_pages) {
+  if (error_pages.begin >= error_pages.end)
     return;
-  if (error_pages.size() % 2 != 0)
+  if ((error_pages.end - error_pages.begin) % 2 != 0)
     throw std::runtime_error("Error page initialization failed");
-  for (size_t i = 0; i + 1 < error_pages.size(); i += 2) {
-    const std::string &code = error_pages[i];
-    if (!isAllDigits(code) || code.size() != 3)
+  for (size_t i = error_pages.begin; i + 1 < error_pages.end; i += 2) {
+    const StringSpan code = tokens.text(i);
+    uint64_t parsed_code = 0;
+    if (code.length != 3 || !parseUnsigned(code, 999, parsed_code))
       throw std::runtime_error("Error code is invalid");
-    short status_code = static_cast<short>(stoiStrict(code));
+    short status_code = static_cast<short>(parsed_code);
     if (statusCodeToString(status_code) == "Undefined" || status_code < 400)
-      throw std::runtime_error("Incorrect error code: " + code);
-    std::string path = error_pages[i + 1];
-    if (!path.empty() && path[path.size() - 1] == ';')
-      path = normalizeDirective(path, "error_page");
-    std::string candidate = path;
-    if (ConfigurationFile::getTypePath(candidate) != 1)
-      candidate = joinPaths(_root, path);
-    if (ConfigurationFile::getTypePath(candidate) != 1)
-      throw std::runtime_error("Incorrect path for error page file: " +
-                               candidate);
-    if (ConfigurationFile::checkFile(candidate, 0) == -1 ||
-        ConfigurationFile::checkFile(candidate, 4) == -1)
-      throw std::runtime_error("Error page file :" + candidate +
-                               " is not accessible");
-    std::map<short, std::string>::iterator it = _error_pages.find(status_code);
+      throw std::runtime_error("Incorrect error code: " + code.str());
+    StringSpan path_value = tokens.text(i + 1);
+    if (path_value.back() == ';')
+      path_value = normalizeDirective(path_value, "error_page");
+    const std::string path = path_value.str();
+    PathCheck check;
+    check.addCandidate(path);
+    check.addCandidate(_root_directory, path);
+    check.match = PathCheck::FIRST_OF_TYPE;
+    check.modes = accessBit(F_OK) | accessBit(R_OK);
+    check.missing = "Incorrect path for error page file: %s";
+    check.denied = "Error page file :%s is not accessible";
+    std::string error;
+    if (!requirePath(check, error))
+      throw std::runtime_error(error);
+    const InternedString interned(path_value);
+    std::map<short, InternedString>::iterator it =
+        _error_pages.find(status_code);
     if (it != _error_pages.end())
-      it->second = path;
+      it->second = interned;
     else
-      _error_pages.insert(std::make_pair(status_code, path));
+      _error_pages.insert(std::make_pair(status_code, interned));
+  }
+}
+
+void WebserverConfig::reserveLocationBlocks(size_t count) {
+  _location_blocks.reserve(_location_blocks.size() + count);
+  rehashPaths(_location_slots, _location_blocks,
+              _location_blocks.size() + count);
+}
+
+void WebserverConfig::setLocationBlocks(const std::string &path,
+                                        const ConfigLexer &tokens,
+                                        const TokenRange &parameters) {
+  // Rejected before the block is parsed, so its files are never probed.
+  if (_location_slots.size() / 2 < _location_blocks.size() + 1)
+    rehashPaths(_location_slots, _location_blocks,
+                _location_blocks.size() + 1);
+  const size_t slot = findPath(_location_slots, _location_blocks, path);
+  if (_location_slots[slot])
+    throw std::runtime_error("Locaition is duplicated");
+  _location_blocks.push_back(LocationBlock());
+  try {
+    _parseLocationBlock(path, tokens, parameters, _location_blocks.back());
+  } catch (...) {
+    _location_blocks.pop_back();
+    throw;
   }
+  _location_slots[slot] = _location_blocks.size();
 }
 
-void WebserverConfig::setLocationBlocks(
-    std::string path, const std::vector<std::string> &parameters) {
-  LocationBlock new_location;
-  bool has_methods = false;
-  bool has_autoindex = false;
-  bool has_max_size = false;
+void WebserverConfig::_parseLocationBlock(const std::string &path,
+                                          const ConfigLexer &tokens,
+                                          const TokenRange &parameters,
+                                          LocationBlock &new_location) {
+  const DirectiveTable<LocationDirective> &directives = locationDirectives();
+  LocationScope scope(tokens, parameters, _root.str(), new_location);
+  unsigned long seen = 0;
 
   new_location.setPath(path);
-  for (size_t i = 0; i < parameters.size(); ++i) {
-    if (parameters[i] == "root" && (i + 1) < parameters.size()) {
-      if (!new_location.getRoot().empty())
-        throw std::runtime_error("Root of location is duplicated");
-      std::string value = parameters[++i];
-      value = normalizeDirective(value, "location root");
-      if (ConfigurationFile::getTypePath(value) == 2)
-        new_location.setRoot(value);
-      else
-        new_location.setRoot(joinPaths(_root, value));
-    } else if ((parameters[i] == "allow_methods" ||
-                parameters[i] == "methods" ||
-                parameters[i] == "allowed_methods") &&
-               (i + 1) < parameters.size()) {
-      if (has_methods)
-        throw std::runtime_error("Allow_methods of location is duplicated");
-      std::vector<std::string> methods;
-      while (++i < parameters.size()) {
-        if (parameters[i].find(';') != std::string::npos) {
-          std::string value = parameters[i];
-          value = normalizeDirective(value, "allow_methods");
-          methods.push_back(value);
-          break;
-        } else {
-          methods.push_back(parameters[i]);
-          if (i + 1 >= parameters.size())
-            throw std::runtime_error("Token is invalid");
-        }
-      }
-      new_location.setMethods(methods);
-      has_methods = true;
-    } else if (parameters[i] == "autoindex" && (i + 1) < parameters.size()) {
-      if (path == "/cgi-bin")
-        throw std::runtime_error("Parametr autoindex not allow for CGI");
-      if (has_autoindex)
-        throw std::runtime_error("Autoindex of location is duplicated");
-      std::string value = parameters[++i];
-      value = normalizeDirective(value, "location autoindex");
-      new_location.setAutoindex(value);
-      has_autoindex = true;
-    } else if (parameters[i] == "index" && (i + 1) < parameters.size()) {
-      if (!new_location.getIndex().empty())
-        throw std::runtime_error("Index of location is duplicated");
-      std::string value = parameters[++i];
-      value = normalizeDirective(value, "location index");
-      new_location.setIndex(value);
-    } else if (parameters[i] == "return" && (i + 1) < parameters.size()) {
-      if (path == "/cgi-bin")
-        throw std::runtime_error("Parametr return not allow for CGI");
-      if (!new_location.getReturn().empty())
-        throw std::runtime_error("Return of location is duplicated");
-      std::string value = parameters[++i];
-      value = normalizeDirective(value, "location return");
-      new_location.setReturn(value);
-    } else if (parameters[i] == "alias" && (i + 1) < parameters.size()) {
-      if (path == "/cgi-bin")
-        throw std::runtime_error("Parametr alias not allow for CGI");
-      if (!new_location.getAlias().empty())
-        throw std::runtime_error("Alias of location is duplicated");
-      std::string value = parameters[++i];
-      value = normalizeDirective(value, "location alias");
-      new_location.setAlias(value);
-    } else if (parameters[i] == "cgi_ext" && (i + 1) < parameters.size()) {
-      std::vector<std::string> extensions;
-      while (++i < parameters.size()) {
-        if (parameters[i].find(';') != std::string::npos) {
-          std::string value = parameters[i];
-          value = normalizeDirective(value, "cgi_ext");
-          extensions.push_back(value);
-          break;
-        } else {
-          extensions.push_back(parameters[i]);
-          if (i + 1 >= parameters.size())
-            throw std::runtime_error("Token is invalid");
-        }
-      }
-      new_location.setCgiExtensions(extensions);
-    } else if (parameters[i] == "cgi_path" && (i + 1) < parameters.size()) {
-      std::vector<std::string> paths_list;
-      while (++i < parameters.size()) {
-        if (parameters[i].find(';') != std::string::npos) {
-          std::string value = parameters[i];
-          value = normalizeDirective(value, "cgi_path");
-          if (value.find("/python") == std::string::npos &&
-              value.find("/bash") == std::string::npos)
-            throw std::runtime_error("cgi_path is invalid");
-          paths_list.push_back(value);
-          break;
-        } else {
-          if (parameters[i].find("/python") == std::string::npos &&
-              parameters[i].find("/bash") == std::string::npos)
-            throw std::runtime_error("cgi_path is invalid");
-          paths_list.push_back(parameters[i]);
-          if (i + 1 >= parameters.size())
-            throw std::runtime_error("Token is invalid");
-        }
-      }
-      new_location.setCgiPaths(paths_list);
-    } else if (parameters[i] == "client_max_body_size" &&
-               (i + 1) < parameters.size()) {
-      if (has_max_size)
-        throw std::runtime_error("Maxbody_size of location is duplicated");
-      std::string value = parameters[++i];
-      value = normalizeDirective(value, "location client_max_body_size");
-      new_location.setMaxBodySize(value);
-      has_max_size = true;
-    } else if (i < parameters.size()) {
+  for (size_t i = parameters.begin; i < parameters.end; ++i) {
+    const LocationDirective *directive = NULL;
+    if (tokens.isWord(i) && (i + 1) < parameters.end)
+      directive = directives.find(tokens.text(i));
+    if (!directive)
       throw std::runtime_error("Parametr in a location is invalid");
-    }
+    if (directive->cgi_error && path == "/cgi-bin")
+      throw std::runtime_error(directive->cgi_error);
+    DirectiveTable<LocationDirective>::claim(*directive, seen);
+    directive->handler(scope, i);
   }
 
+  const bool has_max_size = (seen & (1UL << LOCATION_MAX_BODY_SIZE)) != 0;
   if (new_location.getPath() != "/cgi-bin" && new_location.getIndex().empty())
     new_location.setIndex(_index);
   if (!has_max_size)
@@ -310,8 +451,6 @@ void WebserverConfig::setLocationBlocks(
     throw std::runtime_error("Failed alias file in location validation");
   else if (validation == 5)
     throw std::runtime_error("Failed index file in location validation");
-
-  _location_blocks.push_back(new_location);
 }
 
 bool WebserverConfig::isValidHost(std::string host) const {
@@ -321,18 +460,22 @@ bool WebserverConfig::isValidHost(std::string host) const {
 }
 
 bool WebserverConfig::isValidErrorPages() {
-  std::map<short, std::string>::const_iterator it;
+  std::map<short, InternedString>::const_iterator it;
   for (it = _error_pages.begin(); it != _error_pages.end(); ++it) {
     if (it->first < 100 || it->first > 599)
       return false;
-    if (it->second.empty())
+    const std::string &path = it->second.str();
+    if (path.empty())
       continue;
-    std::string candidate = it->second;
-    if (ConfigurationFile::getTypePath(candidate) != 1)
-      candidate = joinPaths(getRoot(), it->second);
-    if (ConfigurationFile::getTypePath(candidate) != 1 ||
-        ConfigurationFile::checkFile(candidate, 0) < 0 ||
-        ConfigurationFile::checkFile(candidate, 4) < 0)
+    PathCheck check;
+    check.addCandidate(path);
+    check.addCandidate(_root_directory, path);
+    check.match = PathCheck::FIRST_OF_TYPE;
+    check.modes = accessBit(F_OK) | accessBit(R_OK);
+    check.missing = "Incorrect path for error page or number of error";
+    check.denied = check.missing;
+    std::string error;
+    if (!requirePath(check, error))
       return false;
   }
   return true;
@@ -345,29 +488,30 @@ int WebserverConfig::isValidLocationBlock(LocationBlock &location_block) const {
         location_block.getIndex().empty())
       return 1;
     if (ConfigurationFile::checkFile(location_block.getIndex(), 4) < 0) {
-      std::string candidate = joinPaths(
-          joinPaths(location_block.getRoot(), location_block.getPath()),
-          location_block.getIndex());
-      if (ConfigurationFile::getTypePath(candidate) != 1) {
-        char cwd[1024];
-        if (!getcwd(cwd, sizeof(cwd)))
+      const std::string below =
+          joinPaths(location_block.getPath(), location_block.getIndex());
+      if (typeBelowRoot(location_block, below) != 1) {
+        std::string cwd;
+        if (!ConfigurationFile::getCurrentDirectory(cwd))
           return 1;
-        location_block.setRoot(std::string(cwd));
-        candidate = joinPaths(
-            joinPaths(location_block.getRoot(), location_block.getPath()),
-            location_block.getIndex());
+        location_block.setRoot(cwd);
       }
-      if (candidate.empty() || ConfigurationFile::getTypePath(candidate) != 1 ||
-          ConfigurationFile::checkFile(candidate, 4) < 0)
+      if (typeBelowRoot(location_block, below) != 1 ||
+          checkBelowRoot(location_block, below, 4) < 0)
         return 1;
     }
     if (location_block.getCgiPaths().size() !=
         location_block.getCgiExtensions().size())
       return 1;
-    for (std::vector<std::string>::const_iterator it =
+    for (std::vector<InternedString>::const_iterator it =
              location_block.getCgiPaths().begin();
          it != location_block.getCgiPaths().end(); ++it) {
-      if (ConfigurationFile::getTypePath(*it) < 0)
+      PathCheck check;
+      check.addCandidate(it->str());
+      check.type = 0;
+      check.missing = "Failed CGI validation";
+      std::string error;
+      if (!requirePath(check, error))
         return 1;
     }
     location_block._extension_to_cgi.clear();
@@ -377,15 +521,15 @@ int WebserverConfig::isValidLocationBlock(LocationBlock &location_block) const {
       const std::string &ext = *it;
       if (ext != ".py" && ext != "*.py" && ext != ".sh" && ext != "*.sh")
         return 1;
-      for (std::vector<std::string>::const_iterator path_it =
+      for (std::vector<InternedString>::const_iterator path_it =
                location_block.getCgiPaths().begin();
            path_it != location_block.getCgiPaths().end(); ++path_it) {
         if ((ext == ".py" || ext == "*.py") &&
-            path_it->find("python") != std::string::npos)
+            path_it->str().find("python") != std::string::npos)
           location_block._extension_to_cgi.insert(
               std::make_pair(".py", *path_it));
         else if ((ext == ".sh" || ext == "*.sh") &&
-                 path_it->find("bash") != std::string::npos)
+                 path_it->str().find("bash") != std::string::npos)
           location_block._extension_to_cgi[".sh"] = *path_it;
       }
     }
@@ -396,26 +540,32 @@ int WebserverConfig::isValidLocationBlock(LocationBlock &location_block) const {
     if (location_block.getPath().empty() || location_block.getPath()[0] != '/')
       return 2;
     if (location_block.getRoot().empty())
-      location_block.setRoot(_root);
-    std::string location_root =
-        joinPaths(location_block.getRoot(), location_block.getPath());
-    if (ConfigurationFile::getTypePath(location_root) == 2) {
-      std::string candidate_index =
-          joinPaths(location_root, location_block.getIndex());
-      if (ConfigurationFile::getTypePath(candidate_index) != 1 ||
-          ConfigurationFile::checkFile(candidate_index, 4) < 0)
-        return 5;
-    }
-    if (!location_block.getReturn().empty()) {
-      if (ConfigurationFile::doesFileExistAndIsReadable(
-              location_block.getRoot(), location_block.getReturn()))
-        return 3;
-    }
-    if (!location_block.getAlias().empty()) {
-      if (ConfigurationFile::doesFileExistAndIsReadable(
-              location_block.getRoot(), location_block.getAlias()))
-        return 4;
-    }
+      location_block.setRoot(_root, _root_directory);
+    std::string error;
+    PathCheck index;
+    index.guard_base = location_block.getRootDirectory();
+    index.guard_dir = location_block.getPath();
+    index.addCandidate(
+        location_block.getRootDirectory(),
+        joinPaths(location_block.getPath(), location_block.getIndex()));
+    index.modes = accessBit(R_OK);
+    index.missing = "Failed index file in location validation";
+    if (!requirePath(index, error))
+      return 5;
+    if (!location_block.getReturn().empty() &&
+        !requirePath(readableFileCheck(
+                         location_block.getRootDirectory(),
+                         location_block.getReturn(),
+                         "Failed redirection file in location validation"),
+                     error))
+      return 3;
+    if (!location_block.getAlias().empty() &&
+        !requirePath(readableFileCheck(
+                         location_block.getRootDirectory(),
+                         location_block.getAlias(),
+                         "Failed alias file in location validation"),
+                     error))
+      return 4;
   }
   return 0;
 }
@@ -428,27 +578,34 @@ const uint16_t &WebserverConfig::getPort() const { return _port; }
 
 const in_addr_t &WebserverConfig::getHost() const { return _host; }
 
-const size_t &WebserverConfig::getMaxBodySize() const { return _max_body_size; }
+const uint64_t &WebserverConfig::getMaxBodySize() const {
+  return _max_body_size;
+}
 
 const std::vector<LocationBlock> &WebserverConfig::getLocationBlocks() const {
   return _location_blocks;
 }
 
-const std::string &WebserverConfig::getRoot() const { return _root; }
+const std::string &WebserverConfig::getRoot() const { return _root.str(); }
+
+const DirectoryHandle &WebserverConfig::getRootDirectory() const {
+  return _root_directory;
+}
 
-const std::map<short, std::string> &WebserverConfig::getErrorPages() const {
+const std::map<short, InternedString> &
+WebserverConfig::getErrorPages() const {
   return _error_pages;
 }
 
-const std::string &WebserverConfig::getIndex() const { return _index; }
+const std::string &WebserverConfig::getIndex() const { return _index.str(); }
 
 const bool &WebserverConfig::getAutoindex() const { return _autoindex; }
 
-const std::string WebserverConfig::getPathErrorPage(short key) const {
-  std::map<short, std::string>::const_iterator it = _error_pages.find(key);
+const std::string &WebserverConfig::getPathErrorPage(short key) const {
+  std::map<short, InternedString>::const_iterator it = _error_pages.find(key);
   if (it == _error_pages.end())
     throw std::runtime_error("Error_page does not exist");
-  return it->second;
+  return it->second.str();
 }
 
 std::vector<LocationBlock>::const_iterator
@@ -466,15 +623,14 @@ void WebserverConfig::checkTokenValidity(std::string &token) {
 }
 
 bool WebserverConfig::checkLocations() const {
-  if (_location_blocks.size() < 2)
-    return false;
-  for (std::vector<LocationBlock>::const_iterator it = _location_blocks.begin();
-       it != _location_blocks.end(); ++it) {
-    for (std::vector<LocationBlock>::const_iterator jt = it + 1;
-         jt != _location_blocks.end(); ++jt) {
-      if (it->getPath() == jt->getPath())
-        return true;
-    }
+  std::vector<size_t> slots;
+  rehashPaths(slots, std::vector<LocationBlock>(), _location_blocks.size());
+  for (size_t i = 0; i < _location_blocks.size(); ++i) {
+    const size_t slot =
+        findPath(slots, _location_blocks, _location_blocks[i].getPath());
+    if (slots[slot])
+      return true;
+    slots[slot] = i + 1;
   }
   return false;
 }
@@ -10,6 +10,7 @@
 #include <sys/socket.h>
 #include <vector>
 
+#include "ConfigLexer.hpp"
 #include "ConfigurationFile.hpp"
 #include "LocationBlock.hpp"
 #include "ParserUtils.hpp"
@@ -19,36 +20,53 @@ private:
   uint16_t _port;
   in_addr_t _host;
   std::string _server_name;
-  std::string _root;
-  std::string _index;
-  size_t _max_body_size;
+  // Servers parsed together, and their locations, share one copy of an
+  // equal root, index or error page.
+  InternedString _root;
+  // _root opened once; files below it are probed relative to it.
+  DirectoryHandle _root_directory;
+  InternedString _index;
+  uint64_t _max_body_size;
   bool _autoindex;
-  std::map<short, std::string> _error_pages;
+  std::map<short, InternedString> _error_pages;
   std::vector<LocationBlock> _location_blocks;
+  // Hash set of the location paths (see setLocationBlocks).
+  std::vector<size_t> _location_slots;
   struct sockaddr_in _server_address;
   int _listen_fd;
 
+  void _parseLocationBlock(const std::string &path, const ConfigLexer &tokens,
+                           const TokenRange &parameters,
+                           LocationBlock &new_location);
+
 public:
   WebserverConfig(void);
   WebserverConfig(const WebserverConfig &other);
   WebserverConfig &operator=(const WebserverConfig &other);
   ~WebserverConfig();
+  // Exchanges contents without copying locations or strings.
+  void swap(WebserverConfig &other);
 
   void initErrorPages(void);
 
   // Setters for our attributes
-  void setServerName(std::string server_name);
-  void setHost(std::string host);
-  void setRoot(std::string root);
+  // Values are spans of the directive token, trailing ';' included.
+  void setServerName(const StringSpan &server_name);
+  void setHost(const StringSpan &host);
+  void setRoot(const StringSpan &root);
   void setFdx(int fd);
-  void setPort(std::string value);
-  void setClientMaxBodySize(std::string value);
-  void setErrorPages(std::vector<std::string> error_pages);
-  void setIndex(std::string index);
+  void setPort(const StringSpan &value);
+  void setClientMaxBodySize(const StringSpan &value);
+  void setErrorPages(const ConfigLexer &tokens, const TokenRange &error_pages);
+  void setIndex(const StringSpan &index);
 
-  void setLocationBlocks(std::string path,
-                         const std::vector<std::string> &parameters);
-  void setAutoindex(std::string autoindex);
+  // Parses the location straight into _location_blocks; reserve first so
+  // earlier blocks are not copied when the vector grows. A path already
+  // present throws "Locaition is duplicated" before the block is parsed.
+  void reserveLocationBlocks(size_t count);
+  void setLocationBlocks(const std::string &path, const ConfigLexer &tokens,
+                         const TokenRange &parameters);
+  void setAutoindex(const StringSpan &autoindex);
 
   // Our validators for our attributes
 
@@ -60,17 +78,25 @@ public:
   const std::string &getServerName() const;
   const uint16_t &getPort() const;
   const in_addr_t &getHost() const;
-  const size_t &getMaxBodySize() const;
+  const uint64_t &getMaxBodySize() const;
   const std::vector<LocationBlock> &getLocationBlocks() const;
   const std::string &getRoot() const;
-  const std::map<short, std::string> &getErrorPages() const;
+  const DirectoryHandle &getRootDirectory() const;
+  const std::map<short, InternedString> &getErrorPages() const;
   const std::string &getIndex() const;
   const bool &getAutoindex() const;
-  const std::string getPathErrorPage(short key) const;
+  const std::string &getPathErrorPage(short key) const;
   std::vector<LocationBlock>::const_iterator
   getLocationBlockByName(const std::string &name) const;
 
+  // What setPort and setHost store, for callers that only need the listen
+  // key of a block (see ServerConfigParser::setLazy).
+  static uint16_t parsePort(const StringSpan &value);
+  static in_addr_t parseHost(const StringSpan &host);
+
   static void checkTokenValidity(std::string &token);
+  // True when two locations share a path; setLocationBlocks already
+  // refuses those, so this only matters for hand-built servers.
   bool checkLocations() const;
 
   void setupWebserver(void);
@@ -0,0 +1,148 @@
+#include "WorkerPool.hpp"
+
+#include <cstdlib>
+#include <unistd.h>
+
+struct WorkerPool::Job {
+  size_t count;
+  size_t next;
+  void (*task)(size_t, void *);
+  void *context;
+};
+
+WorkerPool::WorkerPool(void)
+    : _threads(1), _workers(NULL), _started(0), _job(NULL), _round(0),
+      _active(0), _stopping(false) {
+  pthread_mutex_init(&_lock, NULL);
+  pthread_cond_init(&_wake, NULL);
+  pthread_cond_init(&_idle, NULL);
+}
+
+WorkerPool::WorkerPool(size_t threads)
+    : _threads(resolveThreads(threads)), _workers(NULL), _started(0),
+      _job(NULL), _round(0), _active(0), _stopping(false) {
+  pthread_mutex_init(&_lock, NULL);
+  pthread_cond_init(&_wake, NULL);
+  pthread_cond_init(&_idle, NULL);
+}
+
+WorkerPool::WorkerPool(const WorkerPool &other)
+    : _threads(other._threads), _workers(NULL), _started(0), _job(NULL),
+      _round(0), _active(0), _stopping(false) {
+  pthread_mutex_init(&_lock, NULL);
+  pthread_cond_init(&_wake, NULL);
+  pthread_cond_init(&_idle, NULL);
+}
+
+WorkerPool &WorkerPool::operator=(const WorkerPool &other) {
+  if (this != &other && _threads != other._threads) {
+    _stop();
+    _threads = other._threads;
+  }
+  return (*this);
+}
+
+WorkerPool::~WorkerPool() {
+  _stop();
+  pthread_cond_destroy(&_idle);
+  pthread_cond_destroy(&_wake);
+  pthread_mutex_destroy(&_lock);
+}
+
+void WorkerPool::_drain(Job &job) {
+  for (;;) {
+    const size_t index = __sync_fetch_and_add(&job.next, 1);
+    if (index >= job.count)
+      break;
+    job.task(index, job.context);
+  }
+}
+
+void *WorkerPool::_workerMain(void *arg) {
+  WorkerPool &pool = *static_cast<WorkerPool *>(arg);
+  unsigned long joined = 0;
+  pthread_mutex_lock(&pool._lock);
+  for (;;) {
+    while (!pool._stopping && (!pool._job || pool._round == joined))
+      pthread_cond_wait(&pool._wake, &pool._lock);
+    if (pool._stopping)
+      break;
+    joined = pool._round;
+    Job &job = *pool._job;
+    ++pool._active;
+    pthread_mutex_unlock(&pool._lock);
+    _drain(job);
+    pthread_mutex_lock(&pool._lock);
+    if (--pool._active == 0)
+      pthread_cond_signal(&pool._idle);
+  }
+  pthread_mutex_unlock(&pool._lock);
+  return NULL;
+}
+
+// The calling thread works too, so only _threads - 1 threads are started;
+// a run goes on with fewer if the system refuses some.
+// The handles come from malloc, not operator new: the pool may outlive the
+// arena of the parse that first ran it.
+void WorkerPool::_start(void) {
+  _workers = static_cast<pthread_t *>(
+      std::malloc((_threads - 1) * sizeof(pthread_t)));
+  if (!_workers)
+    return;
+  for (size_t i = 1; i < _threads; ++i) {
+    if (pthread_create(&_workers[_started], NULL, &_workerMain, this) != 0)
+      break;
+    ++_started;
+  }
+}
+
+void WorkerPool::_stop(void) {
+  if (!_workers)
+    return;
+  pthread_mutex_lock(&_lock);
+  _stopping = true;
+  pthread_cond_broadcast(&_wake);
+  pthread_mutex_unlock(&_lock);
+  for (size_t i = 0; i < _started; ++i)
+    pthread_join(_workers[i], NULL);
+  std::free(_workers);
+  _workers = NULL;
+  _started = 0;
+  _stopping = false;
+}
+
+void WorkerPool::run(size_t count, void (*task)(size_t, void *),
+                     void *context) {
+  Job job;
+  job.count = count;
+  job.next = 0;
+  job.task = task;
+  job.context = context;
+  if (_threads < 2 || count < 2) {
+    _drain(job);
+    return;
+  }
+  if (!_workers)
+    _start();
+  pthread_mutex_lock(&_lock);
+  _job = &job;
+  ++_round;
+  pthread_cond_broadcast(&_wake);
+  pthread_mutex_unlock(&_lock);
+  _drain(job);
+  // Workers that have not joined yet will not; wait for those that did.
+  pthread_mutex_lock(&_lock);
+  _job = NULL;
+  while (_active)
+    pthread_cond_wait(&_idle, &_lock);
+  pthread_mutex_unlock(&_lock);
+}
+
+size_t WorkerPool::getThreads(void) const { return _threads; }
+
+size_t WorkerPool::resolveThreads(size_t requested) {
+  if (requested)
+    return requested;
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+  return (online > 0 ? static_cast<size_t>(online) : 1);
+}
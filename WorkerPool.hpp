@@ -0,0 +1,49 @@
+#ifndef WORKERPOOL_HPP
+#define WORKERPOOL_HPP
+
+#include <cstddef>
+#include <pthread.h>
+
+// Fixed-size pool of pthreads for index-parallel work. Tasks pull the next
+// index from a shared counter, so run() hands out [0, count) in order and
+// returns once every task is done; the calling thread works too. The
+// threads are started by the first run() that needs them and wait for the
+// next one until the pool is destroyed, so a pool kept across runs pays for
+// thread creation once. One run() at a time per pool. Tasks must not throw;
+// callers record their own per-index results. A copy has the same size but
+// threads of its own.
+class WorkerPool {
+private:
+  struct Job;
+
+  size_t _threads;
+  pthread_t *_workers; // _threads - 1 handles once started
+  size_t _started;
+  pthread_mutex_t _lock;
+  pthread_cond_t _wake; // a run started, or the pool is stopping
+  pthread_cond_t _idle; // the last worker left the current run
+  Job *_job;            // the run in progress, NULL between runs
+  unsigned long _round; // bumped by every run, so a worker joins it once
+  size_t _active;       // workers inside the current run
+  bool _stopping;
+
+  void _start(void);
+  void _stop(void);
+  static void _drain(Job &job);
+  static void *_workerMain(void *pool);
+
+public:
+  WorkerPool(void);
+  WorkerPool(size_t threads);
+  WorkerPool(const WorkerPool &other);
+  WorkerPool &operator=(const WorkerPool &other);
+  ~WorkerPool();
+
+  void run(size_t count, void (*task)(size_t, void *), void *context);
+  size_t getThreads(void) const;
+
+  // 0 means one thread per online CPU.
+  static size_t resolveThreads(size_t requested);
+};
+
+#endif
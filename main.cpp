@@ -1,21 +1,226 @@
+#include <cstdlib>
+#include <cstring>
 #include <exception>
+#include <iomanip>
 #include <iostream>
 #include <string>
+#include <vector>
 
+#include "BatchValidator.hpp"
+#include "ConfigSnapshot.hpp"
 #include "ServerConfigParser.hpp"
 
+static int usage(const char *program) {
+  std::cerr << "usage: " << program
+            << " [-j threads] [--probe-threads N] [--stream] [--arena] [--lazy]"
+            << " [--fs-manifest file] [--compile file] [config]" << std::endl
+            << "       " << program
+            << " --batch [-j threads] [--fs-manifest file] path..." << std::endl
+            << "       " << program << " --snapshot file" << std::endl
+            << "  -j, --threads N  parse server blocks on N threads"
+            << " (0: one per CPU, default 1)" << std::endl
+            << "  --batch          only validate: check every file and *.conf"
+            << " file of each" << std::endl
+            << "                   directory given, N at a time"
+            << " (default: one per CPU)" << std::endl
+            << "  --probe-threads N  check files referenced by the config on"
+            << " N threads (default "
+            << ServerConfigParser::kDefaultProbeThreads << ")" << std::endl
+            << "  --stream         read the file in chunks and report each"
+            << " server as it is parsed" << std::endl
+            << "  --arena          allocate the parsed cluster from one arena"
+            << " (needs make ARENA=1)" << std::endl
+            << "  --lazy           only check listen keys up front; build each"
+            << " server when first used" << std::endl
+            << "  --fs-manifest F  validate paths against the tree listed in F"
+            << " instead of this host" << std::endl
+            << "  --compile F      write the validated cluster to the snapshot"
+            << " file F" << std::endl
+            << "  --snapshot F     load the snapshot F instead of parsing;"
+            << " fails if its sources changed" << std::endl;
+  return (1);
+}
+
+static void printStreamedServer(const WebserverConfig &server, void *context) {
+  size_t &count = *static_cast<size_t *>(context);
+  std::cout << "Server #" << ++count << ": " << server.getServerName()
+            << " port " << server.getPort() << ", "
+            << server.getLocationBlocks().size() << " location(s)"
+            << std::endl;
+}
+
+static int runBatch(const std::vector<std::string> &paths, size_t threads,
+                    FileSystem *filesystem) {
+  BatchValidator batch;
+  batch.setThreads(threads);
+  batch.setFileSystem(filesystem);
+  for (size_t i = 0; i < paths.size(); ++i)
+    batch.addPath(paths[i]);
+  const size_t invalid = batch.run();
+  const std::vector<BatchValidator::Result> &results = batch.getResults();
+  size_t servers = 0;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BatchValidator::Result &result = results[i];
+    if (result.valid) {
+      servers += result.servers;
+      std::cout << "ok    " << result.path << " (" << result.servers
+                << " server(s))" << std::endl;
+    } else {
+      std::cout << "FAIL  " << result.path << ": " << result.error
+                << std::endl;
+    }
+  }
+  const double seconds = batch.getElapsedMs() / 1000.0;
+  std::cout << results.size() << " file(s), " << invalid << " invalid, "
+            << servers << " server(s) in " << std::fixed
+            << std::setprecision(1) << batch.getElapsedMs() << " ms";
+  if (seconds > 0)
+    std::cout << " (" << results.size() / seconds << " files/s)";
+  std::cout << std::endl;
+  return (invalid ? 1 : 0);
+}
+
+static bool parseThreads(const char *value, size_t &threads) {
+  char *end = NULL;
+  if (!value || !*value || *value == '-')
+    return false;
+  const unsigned long parsed = std::strtoul(value, &end, 10);
+  if (*end || parsed > 1024)
+    return false;
+  threads = parsed;
+  return true;
+}
+
 int main(int argc, char **argv) {
   std::string config_path = "example.conf";
-  if (argc > 1)
-    config_path = argv[1];
+  std::vector<std::string> paths;
+  size_t threads = 1;
+  bool has_threads = false;
+  size_t probe_threads = ServerConfigParser::kDefaultProbeThreads;
+  bool batch = false;
+  bool stream = false;
+  bool arena = false;
+  bool lazy = false;
+  const char *manifest = NULL;
+  const char *compile = NULL;
+  const char *snapshot = NULL;
+  for (int i = 1; i < argc; ++i) {
+    if (!std::strcmp(argv[i], "-j") || !std::strcmp(argv[i], "--threads")) {
+      if (!parseThreads(i + 1 < argc ? argv[++i] : NULL, threads))
+        return (usage(argv[0]));
+      has_threads = true;
+    } else if (!std::strcmp(argv[i], "--probe-threads")) {
+      if (!parseThreads(i + 1 < argc ? argv[++i] : NULL, probe_threads))
+        return (usage(argv[0]));
+    } else if (!std::strcmp(argv[i], "--batch")) {
+      batch = true;
+    } else if (!std::strcmp(argv[i], "--stream")) {
+      stream = true;
+    } else if (!std::strcmp(argv[i], "--arena")) {
+      arena = true;
+    } else if (!std::strcmp(argv[i], "--lazy")) {
+      lazy = true;
+    } else if (!std::strcmp(argv[i], "--fs-manifest")) {
+      if (i + 1 >= argc)
+        return (usage(argv[0]));
+      manifest = argv[++i];
+    } else if (!std::strcmp(argv[i], "--compile")) {
+      if (i + 1 >= argc)
+        return (usage(argv[0]));
+      compile = argv[++i];
+    } else if (!std::strcmp(argv[i], "--snapshot")) {
+      if (i + 1 >= argc)
+        return (usage(argv[0]));
+      snapshot = argv[++i];
+    } else if (!std::strncmp(argv[i], "-j", 2)) {
+      if (!parseThreads(argv[i] + 2, threads))
+        return (usage(argv[0]));
+      has_threads = true;
+    } else if (argv[i][0] == '-') {
+      return (usage(argv[0]));
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (batch ? paths.empty() || stream || arena || lazy
+            : paths.size() > 1 || (stream && lazy))
+    return (usage(argv[0]));
+  if ((compile && (batch || stream)) ||
+      (snapshot && (batch || stream || compile || lazy || !paths.empty())))
+    return (usage(argv[0]));
+  if (!paths.empty())
+    config_path = paths[0];
 
   try {
+    if (snapshot) {
+      ConfigSnapshot loaded;
+      loaded.open(snapshot);
+      std::cout << "Loaded " << loaded.getServerCount()
+                << " server(s) from snapshot " << snapshot << "." << std::endl;
+      return (0);
+    }
+    // The config itself still comes from this host; everything it points
+    // at is looked up in the manifest's tree. Declared first: the parsed
+    // servers hold directories opened through it.
+    MemoryFileSystem remote;
+    if (manifest) {
+      ConfigurationFile reader;
+      remote.loadManifest(reader.getFileContent(manifest));
+      if (batch) {
+        // The configs to check are local files too.
+        BatchValidator local;
+        for (size_t i = 0; i < paths.size(); ++i)
+          local.addPath(paths[i]);
+        for (size_t i = 0; i < local.getPaths().size(); ++i)
+          remote.addFile(local.getPaths()[i],
+                         reader.getFileContent(local.getPaths()[i]));
+      } else {
+        remote.addFile(config_path, reader.getFileContent(config_path));
+      }
+    }
+    if (batch)
+      return (runBatch(paths, has_threads ? threads : 0,
+                       manifest ? &remote : NULL));
     ServerConfigParser parser;
+    parser.setProbeThreads(probe_threads);
+    if (manifest)
+      parser.setFileSystem(&remote);
+    if (stream) {
+      size_t count = 0;
+      parser.streamCluster(config_path, &printStreamedServer, &count);
+      std::cout << "Successfully parsed " << count
+                << " server(s) from configuration file." << std::endl;
+      return (0);
+    }
+    parser.setThreads(threads);
+    if (arena && !ParseArena::hooksInstalled())
+      std::cerr << "--arena: built without ARENA=1, using the heap"
+                << std::endl;
+    parser.setUseArena(arena);
+    parser.setLazy(lazy);
     parser.createCluster(config_path);
-    std::vector<WebserverConfig> servers = parser.getServers();
-    std::cout << "Successfully parsed " << servers.size()
+    if (compile) {
+      parser.materializeServers();
+      ConfigSnapshot::write(compile, parser.getServers(), parser.getSources());
+      std::cout << "Compiled " << parser.getServers().size()
+                << " server(s) into " << compile << "." << std::endl;
+      return (0);
+    }
+    if (lazy) {
+      std::cout << "Indexed " << parser.getServerCount()
+                << " server(s) from configuration file." << std::endl;
+      // Only the server set up here is parsed and validated.
+      if (parser.getServerCount()) {
+        WebserverConfig server(parser.getServer(0));
+        server.setupWebserver();
+      }
+      return (0);
+    }
+    std::cout << "Successfully parsed " << parser.getServers().size()
               << " server(s) from configuration file." << std::endl;
     parser.print(std::cout);
+    std::vector<WebserverConfig> servers;
+    parser.releaseServers(servers);
     // Setting up the first server as an example
     if (!servers.empty())
       servers[0].setupWebserver();
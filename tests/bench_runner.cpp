@@ -0,0 +1,480 @@
+#include "../CompiledServer.hpp"
+#include "../ConfigLexer.hpp"
+#include "../ConfigScanner.hpp"
+#include "../ServerConfigParser.hpp"
+#include "../StringInterner.hpp"
+
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct BenchResult {
+  double best_ms;
+  size_t items;
+};
+
+static double nowMs(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (static_cast<double>(tv.tv_sec) * 1000.0 +
+          static_cast<double>(tv.tv_usec) / 1000.0);
+}
+
+// Comment-heavy generated config, shaped like our per-tenant output.
+static std::string generateConfig(size_t target_bytes) {
+  std::string config;
+  config.reserve(target_bytes + 1024);
+  size_t server = 0;
+  while (config.size() < target_bytes) {
+    std::stringstream ss;
+    ss << "# tenant " << server << " generated block\n"
+       << "server {\n"
+       << "    listen " << (1024 + server % 60000) << ";   # port\n"
+       << "    host 127.0.0.1;\n"
+       << "    server_name tenant" << server << ".example.com;\n"
+       << "    root ./www;\n"
+       << "    index index.html;\n"
+       << "    client_max_body_size 4096;\n"
+       << "    error_page 404 /errors/404.html;\n"
+       << "\n"
+       << "    location / {\n"
+       << "        allow_methods GET POST;   # defaults\n"
+       << "        index index.html;\n"
+       << "    }\n"
+       << "\n"
+       << "    location /cgi-bin {\n"
+       << "        root ./www;\n"
+       << "        cgi_ext .py .sh;\n"
+       << "        cgi_path /usr/bin/python3 /bin/bash;\n"
+       << "        index handler.py;\n"
+       << "    }\n"
+       << "}\n";
+    config += ss.str();
+    ++server;
+  }
+  return (config);
+}
+
+// The byte-at-a-time lexer this scanner replaced, kept as the baseline. It
+// fills the same token vector so both sides pay for token storage.
+static size_t bytewiseTokenize(const char *data, size_t size,
+                               std::vector<ConfigToken> &tokens) {
+  std::vector<size_t> open_blocks;
+  size_t i = 0;
+  tokens.clear();
+  while (i < size) {
+    const char c = data[i];
+    ConfigToken token;
+    token.match = std::string::npos;
+    token.offset = i;
+    token.length = 1;
+    if (c == ' ' || (c >= '\t' && c <= '\r')) {
+      ++i;
+      continue;
+    } else if (c == '#') {
+      while (i < size && data[i] != '\n')
+        ++i;
+      continue;
+    } else if (c == '{') {
+      token.type = TOKEN_BLOCK_START;
+      open_blocks.push_back(tokens.size());
+      ++i;
+    } else if (c == '}') {
+      token.type = TOKEN_BLOCK_END;
+      if (!open_blocks.empty()) {
+        token.match = open_blocks.back();
+        tokens[open_blocks.back()].match = tokens.size();
+        open_blocks.pop_back();
+      }
+      ++i;
+    } else {
+      token.type = TOKEN_WORD;
+      while (i < size && data[i] != ' ' &&
+             (data[i] < '\t' || data[i] > '\r') && data[i] != '#' &&
+             data[i] != '{' && data[i] != '}') {
+        if (data[i++] == ';')
+          break;
+      }
+      token.length = i - token.offset;
+    }
+    tokens.push_back(token);
+  }
+  return (tokens.size());
+}
+
+static BenchResult benchBytewise(const std::string &config, int rounds) {
+  BenchResult result;
+  result.best_ms = 0;
+  result.items = 0;
+  for (int r = 0; r < rounds; ++r) {
+    std::vector<ConfigToken> tokens;
+    const double start = nowMs();
+    result.items = bytewiseTokenize(config.data(), config.size(), tokens);
+    const double elapsed = nowMs() - start;
+    if (r == 0 || elapsed < result.best_ms)
+      result.best_ms = elapsed;
+  }
+  return (result);
+}
+
+static BenchResult benchScan(const std::string &config, ScanKernel kernel,
+                             int rounds) {
+  BenchResult result;
+  result.best_ms = 0;
+  result.items = 0;
+  ConfigScanner scanner(kernel);
+  for (int r = 0; r < rounds; ++r) {
+    const double start = nowMs();
+    scanner.scan(config.data(), config.size());
+    const double elapsed = nowMs() - start;
+    result.items = scanner.getIndex().size();
+    if (r == 0 || elapsed < result.best_ms)
+      result.best_ms = elapsed;
+  }
+  return (result);
+}
+
+static BenchResult benchLexer(const std::string &config, ScanKernel kernel,
+                              int rounds) {
+  BenchResult result;
+  result.best_ms = 0;
+  result.items = 0;
+  for (int r = 0; r < rounds; ++r) {
+    ConfigLexer lexer;
+    lexer.setScanKernel(kernel);
+    const double start = nowMs();
+    lexer.tokenize(config.data(), config.size());
+    const double elapsed = nowMs() - start;
+    result.items = lexer.size();
+    if (r == 0 || elapsed < result.best_ms)
+      result.best_ms = elapsed;
+  }
+  return (result);
+}
+
+static void printRow(const std::string &name, const BenchResult &result,
+                     size_t bytes, const char *unit) {
+  const double mb = static_cast<double>(bytes) / (1024.0 * 1024.0);
+  std::cout << "  " << std::setw(24) << std::left << name << std::right
+            << std::fixed << std::setprecision(2) << std::setw(10)
+            << result.best_ms << " ms " << std::setw(10)
+            << (result.best_ms > 0 ? mb * 1000.0 / result.best_ms : 0.0)
+            << " MB/s " << std::setw(10) << result.items << " " << unit
+            << std::endl;
+}
+
+// Servers with distinct ports, so the whole file passes validation.
+static std::string generateCluster(size_t servers) {
+  std::stringstream ss;
+  for (size_t i = 0; i < servers; ++i) {
+    ss << "server {\n"
+       << "    listen " << (1024 + i % 64000) << ";\n"
+       << "    host 127.0.0." << (1 + i / 64000) << ";\n"
+       << "    server_name tenant" << i << ".example.com;\n"
+       << "    root ./www;\n"
+       << "    index index.html;\n"
+       << "    error_page 404 /errors/404.html;\n"
+       << "    location / {\n"
+       << "        allow_methods GET POST;\n"
+       << "        index index.html;\n"
+       << "    }\n"
+       << "    location /cgi-bin {\n"
+       << "        root ./www;\n"
+       << "        cgi_ext .py .sh;\n"
+       << "        cgi_path /usr/bin/python3 /bin/bash;\n"
+       << "        index handler.py;\n"
+       << "    }\n"
+       << "}\n";
+  }
+  return (ss.str());
+}
+
+struct ClusterResult {
+  double parse_ms;
+  double teardown_ms;
+  size_t mallocs;
+  size_t frees;
+  size_t arena_bytes;
+};
+
+static ClusterResult benchCluster(const std::string &path, bool arena,
+                                  FileSystem *filesystem, int rounds) {
+  ClusterResult result;
+  result.parse_ms = 0;
+  result.teardown_ms = 0;
+  for (int r = 0; r < rounds; ++r) {
+    ServerConfigParser *parser = new ServerConfigParser();
+    parser->setUseArena(arena);
+    parser->setFileSystem(filesystem);
+    const AllocationCounters before = ParseArena::readCounters();
+    const double start = nowMs();
+    parser->createCluster(path);
+    const double parsed = nowMs();
+    const AllocationCounters built = ParseArena::readCounters();
+    result.arena_bytes = parser->getArena().getUsed();
+    delete parser;
+    const double done = nowMs();
+    const AllocationCounters after = ParseArena::readCounters();
+    if (r == 0 || parsed - start < result.parse_ms)
+      result.parse_ms = parsed - start;
+    if (r == 0 || done - parsed < result.teardown_ms)
+      result.teardown_ms = done - parsed;
+    result.mallocs = built.mallocs - before.mallocs;
+    // Minus the parser object itself.
+    result.frees = after.frees - built.frees - 1;
+  }
+  return (result);
+}
+
+static void printClusterRow(const char *name, const ClusterResult &result) {
+  std::cout << "  " << std::setw(24) << std::left << name << std::right
+            << std::fixed << std::setprecision(2) << std::setw(10)
+            << result.parse_ms << " ms " << std::setw(10)
+            << result.teardown_ms << " ms " << std::setw(10) << result.mallocs
+            << " mallocs " << std::setw(10) << result.frees << " frees "
+            << std::setw(10) << result.arena_bytes / 1024 << " KiB arena"
+            << std::endl;
+}
+
+static void benchClusterAllocation(size_t servers, int rounds) {
+  char path[] = "/tmp/parser_bench_XXXXXX";
+  const int fd = mkstemp(path);
+  if (fd < 0) {
+    std::cerr << "cannot create a temporary config" << std::endl;
+    return;
+  }
+  const std::string config = generateCluster(servers);
+  const bool written =
+      write(fd, config.data(), config.size()) ==
+      static_cast<ssize_t>(config.size());
+  close(fd);
+  std::cout << "cluster build: " << servers << " servers, best of " << rounds
+            << " (parse, teardown)" << std::endl;
+  try {
+    if (!written)
+      throw std::runtime_error("short write to temporary config");
+    printClusterRow("default allocator",
+                    benchCluster(path, false, NULL, rounds));
+    printClusterRow("arena", benchCluster(path, true, NULL, rounds));
+    // Same parse with every probe answered by the in-memory tree the test
+    // suite uses, so the numbers leave the disk out.
+    MemoryFileSystem memory;
+    memory.loadManifest(
+        ConfigurationFile().getFileContent("tests/www.manifest"));
+    memory.addFile(path, config);
+    printClusterRow("in-memory fs", benchCluster(path, false, &memory, rounds));
+    printClusterRow("in-memory fs + arena",
+                    benchCluster(path, true, &memory, rounds));
+  } catch (const std::exception &e) {
+    std::cerr << "cluster build failed: " << e.what() << std::endl;
+  }
+  unlink(path);
+}
+
+static void benchStructuralScan(size_t megabytes, int rounds) {
+  const std::string config = generateConfig(megabytes * 1024 * 1024);
+  std::cout << "structural scan: " << config.size() << " bytes, best of "
+            << rounds << std::endl;
+  printRow("bytewise lexer", benchBytewise(config, rounds), config.size(),
+           "tokens");
+
+  const ScanKernel kernels[] = {SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2};
+  for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+    if (!ConfigScanner::isSupported(kernels[i]))
+      continue;
+    const std::string name = ConfigScanner::kernelName(kernels[i]);
+    printRow("scan/" + name, benchScan(config, kernels[i], rounds),
+             config.size(), "positions");
+    printRow("tokenize/" + name, benchLexer(config, kernels[i], rounds),
+             config.size(), "tokens");
+  }
+}
+
+// One server with `count` locations, shaped like an app per path prefix.
+static std::string generateLocations(size_t count) {
+  std::stringstream ss;
+  ss << "server {\n    listen 8080;\n    root ./www;\n"
+     << "    location / {\n        index index.html;\n    }\n";
+  for (size_t i = 0; i < count; ++i) {
+    ss << "    location /app" << i << " {\n"
+       << "        allow_methods GET POST;\n"
+       << "        client_max_body_size " << 1024 + i << ";\n"
+       << "        index index.html;\n"
+       << "    }\n";
+  }
+  ss << "}\n";
+  return (ss.str());
+}
+
+// What a request does with the parse-time objects: walk the locations for
+// the longest matching prefix, then read a few fields of the winner.
+static uint64_t walkLocations(const WebserverConfig &server,
+                              const std::string &uri) {
+  const std::vector<LocationBlock> &locations = server.getLocationBlocks();
+  const LocationBlock *best = NULL;
+  for (size_t i = 0; i < locations.size(); ++i) {
+    const std::string &path = locations[i].getPath();
+    if (path.size() > uri.size() || uri.compare(0, path.size(), path) ||
+        (best && path.size() <= best->getPath().size()))
+      continue;
+    if (!path.empty() && path[path.size() - 1] != '/' &&
+        path.size() < uri.size() && uri[path.size()] != '/')
+      continue;
+    best = &locations[i];
+  }
+  if (!best)
+    return 0;
+  return (best->getMaxBodySize() +
+          best->allowsMethod(LocationBlock::kMethodPost) +
+          best->getRoot().size() + best->getIndex().size());
+}
+
+static uint64_t lookupCompiled(const CompiledServer &server,
+                               const std::string &uri) {
+  const size_t location = server.match(uri);
+  if (location == CompiledServer::npos)
+    return 0;
+  return (server.getMaxBodySize(location) +
+          ((server.getMethods(location) & LocationBlock::kMethodPost) != 0) +
+          server.getRoot(location).length + server.getIndex(location).length);
+}
+
+static void benchLocationLookup(size_t locations, int rounds) {
+  const size_t lookups = 200000;
+  try {
+    MemoryFileSystem memory;
+    memory.loadManifest(
+        ConfigurationFile().getFileContent("tests/www.manifest"));
+    memory.addFile("locations.conf", generateLocations(locations));
+    ServerConfigParser parser;
+    parser.setFileSystem(&memory);
+    parser.createCluster("locations.conf");
+    const WebserverConfig &server = parser.getServers()[0];
+    const CompiledServer compiled(server);
+
+    std::vector<std::string> uris;
+    srand(42);
+    for (size_t i = 0; i < 1024; ++i) {
+      std::stringstream uri;
+      uri << "/app" << rand() % (locations + locations / 4 + 1)
+          << "/static/page.html";
+      uris.push_back(uri.str());
+    }
+    std::cout << "location lookup: " << locations << " locations, "
+              << lookups << " lookups, best of " << rounds << std::endl;
+    double walk_ms = 0;
+    double flat_ms = 0;
+    uint64_t walk_sum = 0;
+    uint64_t flat_sum = 0;
+    for (int r = 0; r < rounds; ++r) {
+      double start = nowMs();
+      walk_sum = 0;
+      for (size_t i = 0; i < lookups; ++i)
+        walk_sum += walkLocations(server, uris[i % uris.size()]);
+      const double walked = nowMs() - start;
+      start = nowMs();
+      flat_sum = 0;
+      for (size_t i = 0; i < lookups; ++i)
+        flat_sum += lookupCompiled(compiled, uris[i % uris.size()]);
+      const double flat = nowMs() - start;
+      if (r == 0 || walked < walk_ms)
+        walk_ms = walked;
+      if (r == 0 || flat < flat_ms)
+        flat_ms = flat;
+    }
+    if (walk_sum != flat_sum)
+      throw std::runtime_error("compiled lookups disagree with the walk");
+    std::cout << "  " << std::setw(24) << std::left << "getLocationBlocks()"
+              << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << walk_ms * 1e6 / lookups << " ns/lookup"
+              << std::endl
+              << "  " << std::setw(24) << std::left << "CompiledServer"
+              << std::right << std::setw(10) << flat_ms * 1e6 / lookups
+              << " ns/lookup " << std::setprecision(2) << std::setw(8)
+              << (flat_ms > 0 ? walk_ms / flat_ms : 0.0) << "x" << std::endl;
+  } catch (const std::exception &e) {
+    std::cerr << "location lookup failed: " << e.what() << std::endl;
+  }
+}
+
+// One line of benchStringInterner: how many values of a kind the servers
+// hold, and in how many distinct copies.
+static void printSharing(const char *kind,
+                         const std::vector<const std::string *> &values) {
+  const std::set<const std::string *> copies(values.begin(), values.end());
+  std::cout << "  " << std::setw(24) << std::left << kind << std::right
+            << std::setw(10) << values.size() << " " << std::setw(10)
+            << copies.size() << " copies" << std::endl;
+}
+
+// What interning roots, indexes, error pages and CGI paths saves on the
+// generated cluster: the characters every holder would have copied against
+// what the parser's table keeps.
+static void benchStringInterner(size_t servers) {
+  try {
+    MemoryFileSystem memory;
+    memory.loadManifest(
+        ConfigurationFile().getFileContent("tests/www.manifest"));
+    memory.addFile("cluster.conf", generateCluster(servers));
+    ServerConfigParser parser;
+    parser.setFileSystem(&memory);
+    parser.createCluster("cluster.conf");
+    const StringInterner::Stats stats = parser.getInterner().readStats();
+    const size_t copied = stats.requested_bytes;
+    std::cout << "string interner: " << servers << " servers" << std::endl
+              << "  " << std::setw(24) << std::left << "values interned"
+              << std::right << std::setw(10) << stats.lookups << " "
+              << std::setw(10) << copied << " bytes as copies" << std::endl
+              << "  " << std::setw(24) << std::left << "stored"
+              << std::right << std::setw(10) << stats.strings << " "
+              << std::setw(10) << stats.stored_bytes << " bytes "
+              << std::fixed << std::setprecision(1) << std::setw(8)
+              << (copied ? 100.0 * stats.stored_bytes / copied : 0.0)
+              << "%" << std::endl;
+    std::vector<const std::string *> pages;
+    std::vector<const std::string *> interpreters;
+    for (size_t i = 0; i < parser.getServers().size(); ++i) {
+      const WebserverConfig &server = parser.getServers()[i];
+      pages.push_back(&server.getPathErrorPage(404));
+      for (size_t j = 0; j < server.getLocationBlocks().size(); ++j) {
+        const LocationBlock &location = server.getLocationBlocks()[j];
+        for (size_t k = 0; k < location.getCgiPaths().size(); ++k)
+          interpreters.push_back(&location.getCgiPaths()[k].str());
+      }
+    }
+    printSharing("error pages", pages);
+    printSharing("cgi paths", interpreters);
+  } catch (const std::exception &e) {
+    std::cerr << "string interner failed: " << e.what() << std::endl;
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t megabytes = 16;
+  int rounds = 5;
+  size_t servers = 2000;
+  if (argc > 1)
+    megabytes = static_cast<size_t>(std::atoi(argv[1]));
+  if (argc > 2)
+    rounds = std::atoi(argv[2]);
+  if (argc > 3)
+    servers = static_cast<size_t>(std::atoi(argv[3]));
+  if (!megabytes || rounds < 1 || !servers) {
+    std::cerr << "usage: parser_bench [megabytes] [rounds] [servers]"
+              << std::endl;
+    return (1);
+  }
+  benchStructuralScan(megabytes, rounds);
+  benchClusterAllocation(servers, rounds);
+  benchLocationLookup(64, rounds);
+  benchStringInterner(servers);
+  return (0);
+}